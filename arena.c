@@ -0,0 +1,181 @@
+#include "arena.h"
+#include "jobs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct overflow_block {
+  struct overflow_block* next;
+} overflow_block_t;
+
+int arena_init(arena_t* arena, size_t size) {
+  memset(arena, 0, sizeof(arena_t));
+  arena->base = malloc(size);
+  if(arena->base == NULL) {
+    printf("[ERROR] Unable to allocate %zu byte arena\n", size);
+    return -1;
+  }
+  arena->size = size;
+  return 0;
+}
+
+void arena_destroy(arena_t* arena) {
+  arena_reset(arena);
+  free(arena->base);
+  arena->base = NULL;
+  arena->size = 0;
+}
+
+static void* align_up(void* ptr, size_t align) {
+  uintptr_t addr = (uintptr_t)ptr;
+  return (void*)((addr + align - 1) & ~(uintptr_t)(align - 1));
+}
+
+void* arena_alloc(arena_t* arena, size_t size, size_t align) {
+  if(align == 0) {
+    align = sizeof(void*);
+  }
+  char* start = align_up(arena->base + arena->used, align);
+  if(start + size <= arena->base + arena->size) {
+    arena->used = start + size - arena->base;
+    if(arena->used > arena->high_water) {
+      arena->high_water = arena->used;
+    }
+    return start;
+  }
+
+  overflow_block_t* block = malloc(sizeof(overflow_block_t) + size + align);
+  if(block == NULL) {
+    return NULL;
+  }
+  block->next = arena->overflow_blocks;
+  arena->overflow_blocks = block;
+  arena->overflows++;
+  return align_up(block + 1, align);
+}
+
+void arena_reset(arena_t* arena) {
+  overflow_block_t* block = arena->overflow_blocks;
+  while(block) {
+    overflow_block_t* next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->overflow_blocks = NULL;
+  arena->used = 0;
+}
+
+size_t arena_mark(arena_t* arena) {
+  return arena->used;
+}
+
+void arena_rewind(arena_t* arena, size_t mark) {
+  if(mark < arena->used) {
+    arena->used = mark;
+  }
+}
+
+int pool_init(pool_t* pool, size_t block_size, int capacity) {
+  memset(pool, 0, sizeof(pool_t));
+  if(block_size < sizeof(void*)) {
+    block_size = sizeof(void*);
+  }
+  block_size = (block_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+  pool->base = malloc(block_size * capacity);
+  if(pool->base == NULL) {
+    printf("[ERROR] Unable to allocate pool of %d %zu byte blocks\n", capacity, block_size);
+    return -1;
+  }
+  pool->block_size = block_size;
+  pool->capacity = capacity;
+  for(int i = capacity - 1; i >= 0; i--) {
+    void** block = (void**)(pool->base + i * block_size);
+    *block = pool->free_list;
+    pool->free_list = block;
+  }
+  return 0;
+}
+
+void pool_destroy(pool_t* pool) {
+  free(pool->base);
+  memset(pool, 0, sizeof(pool_t));
+}
+
+void* pool_alloc(pool_t* pool) {
+  void** block = pool->free_list;
+  if(block == NULL) {
+    return NULL;
+  }
+  pool->free_list = *block;
+  pool->in_use++;
+  if(pool->in_use > pool->high_water) {
+    pool->high_water = pool->in_use;
+  }
+  return block;
+}
+
+void pool_free(pool_t* pool, void* block) {
+  *(void**)block = pool->free_list;
+  pool->free_list = block;
+  pool->in_use--;
+}
+
+static arena_t frame_arenas[MAX_JOB_THREADS];
+static int num_frame_arenas = 0;
+static unsigned int retired_overflows = 0;
+
+int frame_arenas_init(size_t size_per_thread) {
+  int threads = jobs_num_threads();
+  if(threads < 1) {
+    threads = 1;
+  }
+  for(int i = 0; i < threads; i++) {
+    if(arena_init(&frame_arenas[i], size_per_thread) < 0) {
+      frame_arenas_destroy();
+      return -1;
+    }
+    num_frame_arenas++;
+  }
+  return 0;
+}
+
+void frame_arenas_destroy(void) {
+  for(int i = 0; i < num_frame_arenas; i++) {
+    arena_destroy(&frame_arenas[i]);
+  }
+  num_frame_arenas = 0;
+}
+
+arena_t* frame_arena(void) {
+  int index = jobs_thread_index();
+  if(index < 0 || index >= num_frame_arenas) {
+    return NULL;
+  }
+  return &frame_arenas[index];
+}
+
+void frame_arenas_reset(void) {
+  for(int i = 0; i < num_frame_arenas; i++) {
+    retired_overflows += frame_arenas[i].overflows;
+    frame_arenas[i].overflows = 0;
+    arena_reset(&frame_arenas[i]);
+  }
+}
+
+size_t frame_arenas_high_water(void) {
+  size_t high_water = 0;
+  for(int i = 0; i < num_frame_arenas; i++) {
+    high_water += frame_arenas[i].high_water;
+  }
+  return high_water;
+}
+
+unsigned int frame_arenas_overflows(void) {
+  unsigned int overflows = retired_overflows;
+  for(int i = 0; i < num_frame_arenas; i++) {
+    overflows += frame_arenas[i].overflows;
+  }
+  return overflows;
+}
@@ -0,0 +1,67 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define FRAME_ARENA_SIZE (256 * 1024)
+
+/*
+ * Linear allocator.  Allocations are released all at once by
+ * arena_reset().  When the arena is full, allocations fall back to the
+ * heap and are counted as overflows, so a correctly sized arena never
+ * touches malloc after startup.
+ */
+typedef struct {
+  char* base;
+  size_t size;
+  size_t used;
+  size_t high_water;
+  unsigned int overflows;
+  void* overflow_blocks;
+} arena_t;
+
+int arena_init(arena_t* arena, size_t size);
+void arena_destroy(arena_t* arena);
+void* arena_alloc(arena_t* arena, size_t size, size_t align);
+void arena_reset(arena_t* arena);
+/*
+ * Mark/rewind releases everything allocated since the mark, for scratch
+ * space inside a job.  Overflow blocks are still only freed on reset.
+ */
+size_t arena_mark(arena_t* arena);
+void arena_rewind(arena_t* arena, size_t mark);
+
+/*
+ * Fixed-size block allocator for long-lived objects.
+ */
+typedef struct {
+  char* base;
+  size_t block_size;
+  int capacity;
+  int in_use;
+  int high_water;
+  void* free_list;
+} pool_t;
+
+int pool_init(pool_t* pool, size_t block_size, int capacity);
+void pool_destroy(pool_t* pool);
+//Returns NULL when the pool is exhausted
+void* pool_alloc(pool_t* pool);
+void pool_free(pool_t* pool, void* block);
+
+/*
+ * One arena per job thread, all reset together at the end of a frame.
+ */
+int frame_arenas_init(size_t size_per_thread);
+void frame_arenas_destroy(void);
+/*
+ * Arena belonging to the calling job thread, or NULL if the caller is
+ * not a job thread.
+ */
+arena_t* frame_arena(void);
+void frame_arenas_reset(void);
+size_t frame_arenas_high_water(void);
+//Total overflow allocations across all threads since startup
+unsigned int frame_arenas_overflows(void);
+
+#endif
@@ -0,0 +1,172 @@
+#include "atlas.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int atlas_init(texture_atlas_t* atlas, int page_size, int max_layers) {
+  memset(atlas, 0, sizeof(texture_atlas_t));
+  atlas->pixels = calloc((size_t)page_size * page_size * max_layers, 4);
+  if(atlas->pixels == NULL) {
+    printf("[ERROR] Unable to allocate %d texture atlas layers of %dx%d\n",
+	   max_layers, page_size, page_size);
+    return -1;
+  }
+  atlas->page_size = page_size;
+  atlas->max_layers = max_layers;
+  atlas->packed.layer = -1;
+  atlas->tiling.layer = -1;
+  return 0;
+}
+
+void atlas_destroy(texture_atlas_t* atlas) {
+  free(atlas->pixels);
+  atlas->pixels = NULL;
+}
+
+static int new_layer(texture_atlas_t* atlas) {
+  if(atlas->num_layers >= atlas->max_layers) {
+    printf("[ERROR] Texture atlas is out of layers (max %d)\n", atlas->max_layers);
+    return -1;
+  }
+  return atlas->num_layers++;
+}
+
+/*
+ * Finds room for a w x h block (padding included) on the current
+ * shelf, a new shelf, or a new layer.  The block's position is rounded
+ * up to a multiple of align in each direction.
+ */
+static int shelf_pack(texture_atlas_t* atlas, atlas_shelf_t* shelf, int w, int h, int align,
+		      int* x, int* y) {
+  if(w > atlas->page_size || h > atlas->page_size) {
+    return -1;
+  }
+  int shelf_x = (shelf->x + align - 1) / align * align;
+  if(shelf->layer >= 0 && shelf_x + w > atlas->page_size) {
+    shelf_x = 0;
+    shelf->y += shelf->height;
+    shelf->height = 0;
+  }
+  int shelf_y = (shelf->y + align - 1) / align * align;
+  if(shelf->layer < 0 || shelf_y + h > atlas->page_size) {
+    shelf->layer = new_layer(atlas);
+    if(shelf->layer < 0) {
+      return -1;
+    }
+    shelf_x = 0;
+    shelf_y = 0;
+    shelf->y = 0;
+    shelf->height = 0;
+  }
+  *x = shelf_x;
+  *y = shelf_y;
+  shelf->x = shelf_x + w;
+  if(shelf_y + h - shelf->y > shelf->height) {
+    shelf->height = shelf_y + h - shelf->y;
+  }
+  return shelf->layer;
+}
+
+//Copies the image over a w x h area starting at (x, y), repeating it from (x0, y0)
+static void fill_repeated(texture_atlas_t* atlas, int layer, int x, int y, int w, int h,
+			  const unsigned char* rgba, int width, int height, int pitch,
+			  int x0, int y0) {
+  size_t page_bytes = (size_t)atlas->page_size * atlas->page_size * 4;
+  unsigned char* page = atlas->pixels + page_bytes * layer;
+  for(int row = 0; row < h; row++) {
+    int src_row = ((row - y0) % height + height) % height;
+    unsigned char* dst = page + ((size_t)(y + row) * atlas->page_size + x) * 4;
+    const unsigned char* src = rgba + (size_t)src_row * pitch;
+    for(int col = 0; col < w; col++) {
+      int src_col = ((col - x0) % width + width) % width;
+      memcpy(dst + col * 4, src + src_col * 4, 4);
+    }
+  }
+}
+
+int atlas_add_image(texture_atlas_t* atlas,
+		    const unsigned char* rgba, int width, int height, int pitch,
+		    atlas_region_t* region) {
+  int layer;
+  int x;
+  int y;
+  int pad = ATLAS_PADDING;
+  if(width == atlas->page_size && height == atlas->page_size) {
+    layer = new_layer(atlas);
+    x = 0;
+    y = 0;
+    pad = 0;
+  } else {
+    layer = shelf_pack(atlas, &atlas->packed, width + 2 * pad, height + 2 * pad, 1, &x, &y);
+  }
+  if(layer < 0) {
+    printf("[ERROR] No room in texture atlas for %dx%d image\n", width, height);
+    return -1;
+  }
+
+  //Padding repeats the image like GL_REPEAT would, so tiling stays seamless
+  fill_repeated(atlas, layer, x, y, width + 2 * pad, height + 2 * pad,
+		rgba, width, height, pitch, pad, pad);
+
+  GLfloat scale = 1.0f / atlas->page_size;
+  region->layer = layer;
+  region->rect[0] = (x + pad) * scale;
+  region->rect[1] = (y + pad) * scale;
+  region->rect[2] = width * scale;
+  region->rect[3] = height * scale;
+  return 0;
+}
+
+static int is_power_of_two(int n) {
+  return n > 0 && (n & (n - 1)) == 0;
+}
+
+int atlas_add_tiling_image(texture_atlas_t* atlas,
+			   const unsigned char* rgba, int width, int height, int pitch,
+			   atlas_region_t* region) {
+  //Square blocks keep every mip level of the block aligned to whole texels
+  int block = (width > height ? width : height) * ATLAS_TILING_REPEATS;
+  if(!is_power_of_two(width) || !is_power_of_two(height) || block > atlas->page_size) {
+    printf("[ERROR] Tiling textures must be powers of two up to %d; got %dx%d\n",
+	   atlas->page_size / ATLAS_TILING_REPEATS, width, height);
+    return -1;
+  }
+  int x;
+  int y;
+  int layer = shelf_pack(atlas, &atlas->tiling, block, block, block, &x, &y);
+  if(layer < 0) {
+    printf("[ERROR] No room in texture atlas for %dx%d tiling image\n", width, height);
+    return -1;
+  }
+  fill_repeated(atlas, layer, x, y, block, block, rgba, width, height, pitch, 0, 0);
+
+  GLfloat scale = 1.0f / atlas->page_size;
+  region->layer = layer;
+  region->rect[0] = (x + width) * scale;
+  region->rect[1] = (y + height) * scale;
+  region->rect[2] = width * scale;
+  region->rect[3] = height * scale;
+  return 0;
+}
+
+GLuint atlas_upload(texture_atlas_t* atlas) {
+  GLuint tex;
+  glGenTextures(1, &tex);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA,
+	       atlas->page_size, atlas->page_size, atlas->num_layers,
+	       0,
+	       GL_RGBA, GL_UNSIGNED_BYTE, atlas->pixels);
+  glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  //The shader wraps within each region, and both padding and tiling blocks
+  //give filtering real neighbours there, so it never has to leave the layer
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  printf("[INFO] Uploaded texture atlas: %d layer(s) of %dx%d\n",
+	 atlas->num_layers, atlas->page_size, atlas->page_size);
+  return tex;
+}
@@ -0,0 +1,74 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <epoxy/gl.h>
+
+//Texels of wrapped border around each packed image, to keep filtering in bounds
+#define ATLAS_PADDING 4
+//Copies of a tiling image along each side of its block
+#define ATLAS_TILING_REPEATS 4
+
+/*
+ * Where an image ended up: a layer of the texture array and its
+ * normalized rectangle (x, y, width, height) within that layer.
+ */
+typedef struct {
+  GLfloat layer;
+  GLfloat rect[4];
+} atlas_region_t;
+
+//Shelf packer state for the most recent layer of one kind
+typedef struct {
+  int layer;
+  int x;
+  int y;
+  int height;
+} atlas_shelf_t;
+
+/*
+ * Packs RGBA images into square layers of a GL_TEXTURE_2D_ARRAY.
+ * Images exactly page_size on a side get a layer to themselves; other
+ * images are shelf-packed together.  Padding only protects the first
+ * few mip levels of packed images, so tiling images are packed on
+ * separate layers, in aligned blocks that stay intact for longer.
+ */
+typedef struct {
+  int page_size;
+  int max_layers;
+  int num_layers;
+
+  atlas_shelf_t packed;
+  atlas_shelf_t tiling;
+
+  //RGBA8, max_layers pages of page_size * page_size texels
+  unsigned char* pixels;
+} texture_atlas_t;
+
+int atlas_init(texture_atlas_t* atlas, int page_size, int max_layers);
+void atlas_destroy(texture_atlas_t* atlas);
+
+/*
+ * Copies a width x height RGBA image (rows pitch bytes apart) into the
+ * atlas.  Returns -1 if it does not fit.
+ */
+int atlas_add_image(texture_atlas_t* atlas,
+		    const unsigned char* rgba, int width, int height, int pitch,
+		    atlas_region_t* region);
+
+/*
+ * Packs a repeating texture as a block of ATLAS_TILING_REPEATS copies
+ * along each side, aligned to the block size.  The region starts one
+ * copy in, so filtering across its edges reads real wrapped texels, and
+ * mip levels only average this texture until the block is one texel.
+ * Width and height must be powers of two.
+ */
+int atlas_add_tiling_image(texture_atlas_t* atlas,
+			   const unsigned char* rgba, int width, int height, int pitch,
+			   atlas_region_t* region);
+
+/*
+ * Uploads all used layers as a mipmapped GL_TEXTURE_2D_ARRAY.
+ */
+GLuint atlas_upload(texture_atlas_t* atlas);
+
+#endif
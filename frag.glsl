@@ -1,25 +1,52 @@
 #version 330 core
 
 uniform uint time;
-uniform sampler2D tex;
+uniform sampler2DArray tex;
 uniform vec3 ambient_light;
-uniform vec3 diffuse_light_pos;
-uniform vec3 diffuse_light_color;
 uniform bool enable_lighting;
 
+//Clustered point lights; see lights.c
+uniform samplerBuffer light_data;
+uniform usamplerBuffer cluster_grid;
+uniform usamplerBuffer light_indices;
+uniform uvec3 cluster_dims;
+uniform vec4 cluster_params;
+
 in vec2 texcoord;
 in vec3 normal;
 in vec3 frag_pos;
+in float view_depth;
+flat in vec4 tex_rect;
+flat in float tex_layer;
 
 out vec4 color;
 
 void main() {
-  vec4 texcolor = texture(tex, vec2(texcoord.s, 1.0f - texcoord.t));
+  //Wrap within the atlas region; gradients come from the unwrapped coordinates
+  //so mip selection doesn't jump at the seams
+  vec2 tc = vec2(texcoord.s, 1.0f - texcoord.t);
+  vec2 uv = tex_rect.xy + fract(tc) * tex_rect.zw;
+  vec4 texcolor = textureGrad(tex, vec3(uv, tex_layer),
+			      dFdx(tc) * tex_rect.zw, dFdy(tc) * tex_rect.zw);
   if(enable_lighting) {
     vec3 norm = normal;
-    vec3 light_dir = normalize(diffuse_light_pos - frag_pos);
-    float diff = max(dot(norm, light_dir), 0.0f);
-    vec3 diffuse = diff * diffuse_light_color;
+    uint slice = uint(max(log(view_depth) * cluster_params.x + cluster_params.y, 0.0f));
+    uvec3 cluster = min(uvec3(uvec2(gl_FragCoord.xy / cluster_params.zw), slice),
+			cluster_dims - uvec3(1u));
+    int cluster_index = int(cluster.x + cluster_dims.x * (cluster.y + cluster_dims.y * cluster.z));
+    uvec2 span = texelFetch(cluster_grid, cluster_index).xy;
+
+    vec3 diffuse = vec3(0.0f);
+    for(uint i = 0u; i < span.y; i++) {
+      int light = int(texelFetch(light_indices, int(span.x + i)).r);
+      vec4 pos_radius = texelFetch(light_data, light * 2);
+      vec3 light_color = texelFetch(light_data, light * 2 + 1).rgb;
+      vec3 to_light = pos_radius.xyz - frag_pos;
+      float dist = length(to_light);
+      float falloff = clamp(1.0f - dist / pos_radius.w, 0.0f, 1.0f);
+      float diff = max(dot(norm, to_light / dist), 0.0f);
+      diffuse += diff * falloff * falloff * light_color;
+    }
     color = texcolor * vec4(ambient_light + diffuse, 1.0f);
   } else {
     color = texcolor;
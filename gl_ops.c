@@ -28,7 +28,7 @@ char* slurp_file(const char* filename) {
   }
 
   char* file_bytes = malloc(file_stat.st_size + 1);
-  memset(file_bytes, 0, file_stat.st_size + 1);
+  file_bytes[file_stat.st_size] = '\0';
   char* current = file_bytes;
   while(current - file_bytes < file_stat.st_size) {
     ssize_t bytes_read = read(fd, current, file_stat.st_size - (current - file_bytes));
@@ -47,17 +47,37 @@ char* slurp_file(const char* filename) {
   return file_bytes;
 }
 
-int load_shader(const char* filename, GLint shader_type) {
-  char* shader_source = slurp_file(filename);
-  if(shader_source == NULL) {
-    return -1;
+int load_shader(const asset_pack_t* pack, const char* filename, GLint shader_type) {
+  char* file_source = NULL;
+  pack_blob_t blob;
+  const char* shader_source;
+  GLint source_length;
+  if(pack != NULL) {
+    //Pack entries aren't NUL-terminated, so pass the length along
+    if(pack_get(pack, filename, &blob) < 0) {
+      return -1;
+    }
+    shader_source = blob.data;
+    source_length = blob.size;
+  } else {
+    file_source = slurp_file(filename);
+    if(file_source == NULL) {
+      return -1;
+    }
+    shader_source = file_source;
+    source_length = strlen(file_source);
   }
-  printf("Read %s shader source:\n########\n%s\n########\n",
+  printf("Read %s shader source:\n########\n%.*s\n########\n",
 	 shader_type == GL_VERTEX_SHADER ? "vertex" : "fragment",
-	 shader_source);
+	 (int)source_length, shader_source);
 
   GLuint shader = glCreateShader(shader_type);
-  glShaderSource(shader, 1, (const char**)&shader_source, NULL);
+  glShaderSource(shader, 1, &shader_source, &source_length);
+  if(pack != NULL) {
+    pack_release(&blob);
+  } else {
+    free(file_source);
+  }
   glCompileShader(shader);
   GLint success;
   GLchar info_log[4096];
@@ -67,33 +87,78 @@ int load_shader(const char* filename, GLint shader_type) {
     printf("[ERROR] Failed to compile shader:\n%s\n", info_log);
     return -1;
   }
-  free(shader_source);
   return shader;
 }
 
-GLuint upload_texture(const char* filename) {
-  SDL_Surface* img_surface = IMG_Load(filename);
-  GLuint tex;
-  glGenTextures(1, &tex);
-  glBindTexture(GL_TEXTURE_2D, tex);
-  GLint texmode = GL_RGB;
-  if(img_surface->format->BytesPerPixel == 4) {
-    texmode = GL_RGBA;
-    printf("[INFO] RGBA texture\n");
-  } else {
-    printf("[INFO] RGB texture\n");
+GLuint upload_mesh(const vertex_data_t* vertices, size_t vertex_count,
+		   const GLuint* indices, size_t index_count) {
+  GLuint vbo;
+  glGenBuffers(1, &vbo);
+
+  GLuint ebo;
+  glGenBuffers(1, &ebo);
+
+  GLuint vao;
+  glGenVertexArrays(1, &vao);
+
+  glBindVertexArray(vao);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_data_t) * vertex_count, vertices, GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_data_t), (GLvoid*)0);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(vertex_data_t), (GLvoid*)(3 *  sizeof(GLfloat)));
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_data_t), (GLvoid*)(5 *  sizeof(GLfloat)));
+  glEnableVertexAttribArray(2);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * index_count, indices, GL_STATIC_DRAW);
+  glBindVertexArray(0);
+  return vao;
+}
+
+static SDL_Surface* load_image(const asset_pack_t* pack, const char* filename) {
+  if(pack == NULL) {
+    return IMG_Load(filename);
   }
-  SDL_LockSurface(img_surface);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
-	       img_surface->w, img_surface->h,
-	       0,
-	       texmode, GL_UNSIGNED_BYTE, img_surface->pixels);
-  SDL_UnlockSurface(img_surface);
+  pack_blob_t blob;
+  if(pack_get(pack, filename, &blob) < 0) {
+    return NULL;
+  }
+  SDL_Surface* img_surface = IMG_Load_RW(SDL_RWFromConstMem(blob.data, blob.size), 1);
+  pack_release(&blob);
+  return img_surface;
+}
+
+int atlas_add_texture(texture_atlas_t* atlas, const asset_pack_t* pack,
+		      const char* filename, int tiling, atlas_region_t* region) {
+  SDL_Surface* img_surface = load_image(pack, filename);
+  if(img_surface == NULL) {
+    printf("[ERROR] Unable to load texture %s: %s\n", filename, IMG_GetError());
+    return -1;
+  }
+  SDL_Surface* rgba_surface = SDL_ConvertSurfaceFormat(img_surface, SDL_PIXELFORMAT_RGBA32, 0);
   SDL_FreeSurface(img_surface);
   img_surface = NULL;
+  if(rgba_surface == NULL) {
+    printf("[ERROR] Unable to convert texture %s to RGBA: %s\n", filename, SDL_GetError());
+    return -1;
+  }
 
-  glGenerateMipmap(GL_TEXTURE_2D);
-
-  glBindTexture(GL_TEXTURE_2D, 0);
-  return tex;
+  SDL_LockSurface(rgba_surface);
+  int result;
+  if(tiling) {
+    result = atlas_add_tiling_image(atlas, rgba_surface->pixels,
+				    rgba_surface->w, rgba_surface->h, rgba_surface->pitch,
+				    region);
+  } else {
+    result = atlas_add_image(atlas, rgba_surface->pixels,
+			     rgba_surface->w, rgba_surface->h, rgba_surface->pitch,
+			     region);
+  }
+  SDL_UnlockSurface(rgba_surface);
+  SDL_FreeSurface(rgba_surface);
+  if(result == 0) {
+    printf("[INFO] Packed %s into atlas layer %d\n", filename, (int)region->layer);
+  }
+  return result;
 }
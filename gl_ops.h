@@ -3,11 +3,20 @@
 
 #include <epoxy/gl.h>
 
+#include "atlas.h"
+#include "pack.h"
+
 #define MAX_SHADER_SIZE (16 * 1024)
 
 char* slurp_file(const char* filename);
-int load_shader(const char* filename, GLint shader_type);
-GLuint upload_texture(const char* filename);
+/*
+ * The loaders below read from the asset pack when one is given, and
+ * from loose files in the working directory when pack is NULL.
+ */
+int load_shader(const asset_pack_t* pack, const char* filename, GLint shader_type);
+//Tiling textures go through atlas_add_tiling_image
+int atlas_add_texture(texture_atlas_t* atlas, const asset_pack_t* pack,
+		      const char* filename, int tiling, atlas_region_t* region);
 
 typedef struct {
   GLfloat x;
@@ -22,4 +31,11 @@ typedef struct {
   GLfloat nz;
 } vertex_data_t;
 
+/*
+ * Uploads a static indexed mesh and returns a vertex array with the
+ * vertex_data_t attributes bound to locations 0-2.
+ */
+GLuint upload_mesh(const vertex_data_t* vertices, size_t vertex_count,
+		   const GLuint* indices, size_t index_count);
+
 #endif
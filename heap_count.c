@@ -0,0 +1,28 @@
+#include "heap_count.h"
+
+#include <stddef.h>
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+static unsigned long allocations = 0;
+
+void* __wrap_malloc(size_t size) {
+  __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+  __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+  return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+  __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+  return __real_realloc(ptr, size);
+}
+
+unsigned long heap_allocations(void) {
+  return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,12 @@
+#ifndef HEAP_COUNT_H
+#define HEAP_COUNT_H
+
+/*
+ * Counts heap allocations made by glplay's own code.  glplay links with
+ * -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc, which routes those
+ * calls through the counting wrappers in heap_count.c.  Allocations made
+ * inside libraries (SDL, GL, libc) are not seen.
+ */
+unsigned long heap_allocations(void);
+
+#endif
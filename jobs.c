@@ -0,0 +1,249 @@
+#include "jobs.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+typedef struct {
+  job_func_t func;
+  job_range_func_t range_func;
+  void* data;
+  int start;
+  int end;
+  job_counter_t* counter;
+} job_t;
+
+/*
+ * Chase-Lev work-stealing deque.  The owning thread pushes and pops at
+ * the bottom; every other thread steals from the top.
+ */
+typedef struct {
+  long top;
+  char pad1[64 - sizeof(long)];
+  long bottom;
+  char pad2[64 - sizeof(long)];
+  job_t jobs[JOB_QUEUE_SIZE];
+} __attribute__((aligned(64))) job_deque_t;
+
+static job_deque_t deques[MAX_JOB_THREADS];
+static pthread_t workers[MAX_JOB_THREADS];
+static int num_threads = 0;
+static int quitting = 0;
+static int queued = 0;
+static int sleepers = 0;
+static pthread_mutex_t sleep_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sleep_cond = PTHREAD_COND_INITIALIZER;
+
+static __thread int thread_index = -1;
+static __thread unsigned int steal_seed = 0;
+
+static int deque_push(job_deque_t* deque, job_t* job) {
+  long b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+  long t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+  if(b - t >= JOB_QUEUE_SIZE) {
+    return 0;
+  }
+  deque->jobs[b & (JOB_QUEUE_SIZE - 1)] = *job;
+  __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+static int deque_pop(job_deque_t* deque, job_t* job) {
+  long b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+  __atomic_store_n(&deque->bottom, b, __ATOMIC_SEQ_CST);
+  long t = __atomic_load_n(&deque->top, __ATOMIC_SEQ_CST);
+  if(t > b) {
+    __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+  *job = deque->jobs[b & (JOB_QUEUE_SIZE - 1)];
+  if(t != b) {
+    return 1;
+  }
+  //Last job in the deque; race the thieves for it
+  int won = __atomic_compare_exchange_n(&deque->top, &t, t + 1, 0,
+					__ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+  __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+  return won;
+}
+
+static int deque_steal(job_deque_t* deque, job_t* job) {
+  long t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  long b = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+  if(t >= b) {
+    return 0;
+  }
+  *job = deque->jobs[t & (JOB_QUEUE_SIZE - 1)];
+  return __atomic_compare_exchange_n(&deque->top, &t, t + 1, 0,
+				     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static int next_job(int index, job_t* job) {
+  if(deque_pop(&deques[index], job)) {
+    return 1;
+  }
+  if(num_threads < 2) {
+    return 0;
+  }
+  steal_seed = steal_seed * 1103515245 + 12345;
+  int victim = (steal_seed >> 16) % num_threads;
+  for(int i = 0; i < num_threads; i++) {
+    int candidate = (victim + i) % num_threads;
+    if(candidate != index && deque_steal(&deques[candidate], job)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void run_job(job_t* job) {
+  __atomic_sub_fetch(&queued, 1, __ATOMIC_SEQ_CST);
+  if(job->range_func) {
+    job->range_func(job->data, job->start, job->end);
+  } else {
+    job->func(job->data);
+  }
+  if(job->counter) {
+    __atomic_sub_fetch(&job->counter->pending, 1, __ATOMIC_RELEASE);
+  }
+}
+
+static void wake_workers(void) {
+  if(__atomic_load_n(&sleepers, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&sleep_mutex);
+    pthread_cond_broadcast(&sleep_cond);
+    pthread_mutex_unlock(&sleep_mutex);
+  }
+}
+
+static void* worker_main(void* arg) {
+  thread_index = (int)(long)arg;
+  steal_seed = thread_index * 2654435761u;
+  job_t job;
+  int idle_spins = 0;
+  while(!__atomic_load_n(&quitting, __ATOMIC_ACQUIRE)) {
+    if(next_job(thread_index, &job)) {
+      run_job(&job);
+      idle_spins = 0;
+      continue;
+    }
+    if(++idle_spins < 64) {
+      sched_yield();
+      continue;
+    }
+    pthread_mutex_lock(&sleep_mutex);
+    __atomic_add_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&queued, __ATOMIC_SEQ_CST) == 0 &&
+	  !__atomic_load_n(&quitting, __ATOMIC_ACQUIRE)) {
+      pthread_cond_wait(&sleep_cond, &sleep_mutex);
+    }
+    __atomic_sub_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&sleep_mutex);
+    idle_spins = 0;
+  }
+  return NULL;
+}
+
+int jobs_init(int num_workers) {
+  if(num_workers < 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_workers = cpus > 1 ? cpus - 1 : 0;
+  }
+  if(num_workers > MAX_JOB_THREADS - 1) {
+    num_workers = MAX_JOB_THREADS - 1;
+  }
+
+  memset(deques, 0, sizeof(deques));
+  quitting = 0;
+  queued = 0;
+  thread_index = 0;
+  num_threads = 1;
+  for(int i = 1; i <= num_workers; i++) {
+    int err = pthread_create(&workers[i], NULL, worker_main, (void*)(long)i);
+    if(err != 0) {
+      printf("[ERROR] Unable to start job worker %d: %s\n", i, strerror(err));
+      jobs_shutdown();
+      return -1;
+    }
+    num_threads++;
+  }
+  printf("[INFO] Job system running on %d threads\n", num_threads);
+  return 0;
+}
+
+void jobs_shutdown(void) {
+  pthread_mutex_lock(&sleep_mutex);
+  __atomic_store_n(&quitting, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&sleep_cond);
+  pthread_mutex_unlock(&sleep_mutex);
+  for(int i = 1; i < num_threads; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  num_threads = 0;
+  thread_index = -1;
+}
+
+int jobs_num_threads(void) {
+  return num_threads;
+}
+
+int jobs_thread_index(void) {
+  return thread_index;
+}
+
+static void push_job(job_t* job) {
+  __atomic_add_fetch(&queued, 1, __ATOMIC_SEQ_CST);
+  //Threads outside the job system, or a full deque, run the job inline
+  if(thread_index < 0 || !deque_push(&deques[thread_index], job)) {
+    run_job(job);
+    return;
+  }
+  wake_workers();
+}
+
+void jobs_submit(job_func_t func, void* data, job_counter_t* counter) {
+  job_t job = { func, NULL, data, 0, 0, counter };
+  if(counter) {
+    __atomic_add_fetch(&counter->pending, 1, __ATOMIC_RELAXED);
+  }
+  push_job(&job);
+}
+
+void jobs_parallel_for(job_range_func_t func, void* data,
+		       int count, int batch_size,
+		       job_counter_t* counter) {
+  if(count <= 0) {
+    return;
+  }
+  if(batch_size < 1) {
+    batch_size = 1;
+  }
+  int batches = (count + batch_size - 1) / batch_size;
+  if(counter) {
+    __atomic_add_fetch(&counter->pending, batches, __ATOMIC_RELAXED);
+  }
+  for(int start = 0; start < count; start += batch_size) {
+    int end = start + batch_size < count ? start + batch_size : count;
+    job_t job = { NULL, func, data, start, end, counter };
+    push_job(&job);
+  }
+}
+
+int jobs_counter_done(job_counter_t* counter) {
+  return __atomic_load_n(&counter->pending, __ATOMIC_ACQUIRE) == 0;
+}
+
+void jobs_wait(job_counter_t* counter) {
+  job_t job;
+  while(!jobs_counter_done(counter)) {
+    if(thread_index >= 0 && next_job(thread_index, &job)) {
+      run_job(&job);
+    } else {
+      sched_yield();
+    }
+  }
+}
@@ -0,0 +1,48 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#define MAX_JOB_THREADS 32
+#define JOB_QUEUE_SIZE 4096
+
+typedef void (*job_func_t)(void* data);
+typedef void (*job_range_func_t)(void* data, int start, int end);
+
+/*
+ * A counter is incremented for every job submitted against it and
+ * decremented when that job finishes.  Waiting on a counter is the
+ * fence: once it reaches zero, everything submitted against it is done.
+ */
+typedef struct {
+  int pending;
+} job_counter_t;
+
+/*
+ * Starts num_workers worker threads in addition to the calling thread,
+ * which becomes job thread 0.  Pass a negative value to use one worker
+ * per online CPU beyond the first.
+ */
+int jobs_init(int num_workers);
+void jobs_shutdown(void);
+
+int jobs_num_threads(void);
+/*
+ * Index of the calling thread in [0, jobs_num_threads()), or -1 if the
+ * calling thread is not part of the job system.
+ */
+int jobs_thread_index(void);
+
+void jobs_submit(job_func_t func, void* data, job_counter_t* counter);
+/*
+ * Splits [0, count) into batches of at most batch_size and runs func on
+ * each batch.  Returns immediately; wait on counter for completion.
+ */
+void jobs_parallel_for(job_range_func_t func, void* data,
+		       int count, int batch_size,
+		       job_counter_t* counter);
+/*
+ * Runs queued jobs on the calling thread until counter reaches zero.
+ */
+void jobs_wait(job_counter_t* counter);
+int jobs_counter_done(job_counter_t* counter);
+
+#endif
@@ -0,0 +1,332 @@
+#include "lights.h"
+#include "jobs.h"
+#include "arena.h"
+#include "profiler.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+int light_add(light_list_t* lights,
+	      GLfloat x, GLfloat y, GLfloat z, GLfloat radius,
+	      GLfloat r, GLfloat g, GLfloat b) {
+  if(lights->count >= MAX_LIGHTS) {
+    return -1;
+  }
+  int i = lights->count++;
+  lights->x[i] = x;
+  lights->y[i] = y;
+  lights->z[i] = z;
+  lights->radius[i] = radius;
+  lights->color[i][0] = r;
+  lights->color[i][1] = g;
+  lights->color[i][2] = b;
+  return i;
+}
+
+static int tile_index(GLfloat ndc, int tiles) {
+  int tile = (int)floorf((ndc + 1.0f) * 0.5f * tiles);
+  return tile < 0 ? 0 : (tile >= tiles ? tiles - 1 : tile);
+}
+
+/*
+ * Gathers the lights whose spheres overlap depths [d0, d1], four at a
+ * time where SSE is available.
+ */
+static int slice_candidates(light_clusters_t* clusters, GLfloat d0, GLfloat d1,
+			    GLushort* candidates) {
+  const GLfloat* view_z = clusters->view_z;
+  const GLfloat* radius = clusters->lights->radius;
+  int count = clusters->lights->count;
+  int found = 0;
+  int i = 0;
+#ifdef __SSE__
+  __m128 slice_near = _mm_set1_ps(d0);
+  __m128 slice_far = _mm_set1_ps(d1);
+  for(; i + 4 <= count; i += 4) {
+    //View space looks down -Z, so depth is -z
+    __m128 depth = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(view_z + i));
+    __m128 r = _mm_loadu_ps(radius + i);
+    __m128 hit = _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(depth, r), slice_near),
+			    _mm_cmple_ps(_mm_sub_ps(depth, r), slice_far));
+    int mask = _mm_movemask_ps(hit);
+    while(mask) {
+      candidates[found++] = i + __builtin_ctz(mask);
+      mask &= mask - 1;
+    }
+  }
+#endif
+  for(; i < count; i++) {
+    GLfloat depth = -view_z[i];
+    if(depth + radius[i] >= d0 && depth - radius[i] <= d1) {
+      candidates[found++] = i;
+    }
+  }
+  return found;
+}
+
+static void bin_slice(light_clusters_t* clusters, int slice, arena_t* arena) {
+  const light_list_t* lights = clusters->lights;
+  GLfloat ratio = clusters->far_clip / clusters->near_clip;
+  GLfloat d0 = clusters->near_clip * powf(ratio, (GLfloat)slice / CLUSTER_Z);
+  GLfloat d1 = clusters->near_clip * powf(ratio, (GLfloat)(slice + 1) / CLUSTER_Z);
+
+  GLushort* candidates = arena_alloc(arena, lights->count * sizeof(GLushort) + 16, 16);
+  unsigned char (*rects)[4] = arena_alloc(arena, lights->count * 4 + 4, 4);
+  GLuint cell_counts[CLUSTER_X * CLUSTER_Y];
+  memset(cell_counts, 0, sizeof(cell_counts));
+
+  int num_candidates = slice_candidates(clusters, d0, d1, candidates);
+  int visible = 0;
+  for(int c = 0; c < num_candidates; c++) {
+    int i = candidates[c];
+    GLfloat depth = -clusters->view_z[i];
+    GLfloat r = lights->radius[i];
+    //Screen bounds of the sphere's slab within this slice; x/depth is
+    //monotonic in depth, so the extremes are at the slab's ends
+    GLfloat dn = depth - r > d0 ? depth - r : d0;
+    GLfloat df = depth + r < d1 ? depth + r : d1;
+    GLfloat x = clusters->view_x[i];
+    GLfloat y = clusters->view_y[i];
+    GLfloat xmin = fminf((x - r) / dn, (x - r) / df) * clusters->x_scale;
+    GLfloat xmax = fmaxf((x + r) / dn, (x + r) / df) * clusters->x_scale;
+    GLfloat ymin = fminf((y - r) / dn, (y - r) / df) * clusters->y_scale;
+    GLfloat ymax = fmaxf((y + r) / dn, (y + r) / df) * clusters->y_scale;
+    if(xmax < -1.0f || xmin > 1.0f || ymax < -1.0f || ymin > 1.0f) {
+      continue;
+    }
+    candidates[visible] = i;
+    rects[visible][0] = tile_index(xmin, CLUSTER_X);
+    rects[visible][1] = tile_index(xmax, CLUSTER_X);
+    rects[visible][2] = tile_index(ymin, CLUSTER_Y);
+    rects[visible][3] = tile_index(ymax, CLUSTER_Y);
+    for(int ty = rects[visible][2]; ty <= rects[visible][3]; ty++) {
+      for(int tx = rects[visible][0]; tx <= rects[visible][1]; tx++) {
+	cell_counts[ty * CLUSTER_X + tx]++;
+      }
+    }
+    visible++;
+  }
+
+  //Offsets are relative to this slice's segment until the build compacts them
+  GLuint offset = 0;
+  GLuint dropped = 0;
+  GLuint (*grid)[2] = clusters->grid + slice * CLUSTER_X * CLUSTER_Y;
+  for(int cell = 0; cell < CLUSTER_X * CLUSTER_Y; cell++) {
+    GLuint count = cell_counts[cell];
+    if(offset + count > SLICE_INDEX_CAPACITY) {
+      dropped += offset + count - SLICE_INDEX_CAPACITY;
+      count = SLICE_INDEX_CAPACITY - offset;
+    }
+    grid[cell][0] = offset;
+    grid[cell][1] = 0;
+    cell_counts[cell] = count;
+    offset += count;
+  }
+  clusters->slice_counts[slice] = offset;
+  if(dropped) {
+    __atomic_add_fetch(&clusters->overflows, dropped, __ATOMIC_RELAXED);
+  }
+
+  GLushort* indices = clusters->indices + slice * SLICE_INDEX_CAPACITY;
+  for(int c = 0; c < visible; c++) {
+    for(int ty = rects[c][2]; ty <= rects[c][3]; ty++) {
+      for(int tx = rects[c][0]; tx <= rects[c][1]; tx++) {
+	int cell = ty * CLUSTER_X + tx;
+	if(grid[cell][1] < cell_counts[cell]) {
+	  indices[grid[cell][0] + grid[cell][1]++] = candidates[c];
+	}
+      }
+    }
+  }
+}
+
+/*
+ * Cuts a binned slice down to at most room indices, dropping the
+ * references of its last cells first.  Returns the new slice count.
+ */
+static GLuint trim_slice(light_clusters_t* clusters, int slice, GLuint room) {
+  GLuint (*grid)[2] = clusters->grid + slice * CLUSTER_X * CLUSTER_Y;
+  GLuint dropped = 0;
+  for(int cell = 0; cell < CLUSTER_X * CLUSTER_Y; cell++) {
+    GLuint end = grid[cell][0] + grid[cell][1];
+    if(grid[cell][0] >= room) {
+      dropped += grid[cell][1];
+      grid[cell][0] = room;
+      grid[cell][1] = 0;
+    } else if(end > room) {
+      dropped += end - room;
+      grid[cell][1] = room - grid[cell][0];
+    }
+  }
+  clusters->overflows += dropped;
+  clusters->slice_counts[slice] = room;
+  return room;
+}
+
+static void cluster_slices(void* data, int start, int end) {
+  profile_zone_t zone = profile_begin("cluster slices");
+  light_clusters_t* clusters = data;
+  arena_t* arena = frame_arena();
+  for(int slice = start; slice < end; slice++) {
+    size_t mark = arena_mark(arena);
+    bin_slice(clusters, slice, arena);
+    arena_rewind(arena, mark);
+  }
+  profile_end(&zone);
+}
+
+void lights_build_clusters(light_clusters_t* clusters, const light_list_t* lights,
+			   const GLfloat* view, const GLfloat* projection,
+			   GLfloat near_clip, GLfloat far_clip) {
+  arena_t* arena = frame_arena();
+  size_t floats = lights->count + 4;
+  clusters->lights = lights;
+  clusters->x_scale = projection[0];
+  clusters->y_scale = projection[5];
+  clusters->near_clip = near_clip;
+  clusters->far_clip = far_clip;
+  clusters->view_x = arena_alloc(arena, floats * sizeof(GLfloat), 16);
+  clusters->view_y = arena_alloc(arena, floats * sizeof(GLfloat), 16);
+  clusters->view_z = arena_alloc(arena, floats * sizeof(GLfloat), 16);
+  clusters->overflows = 0;
+
+  for(int i = 0; i < lights->count; i++) {
+    GLfloat x = lights->x[i];
+    GLfloat y = lights->y[i];
+    GLfloat z = lights->z[i];
+    clusters->view_x[i] = view[0] * x + view[1] * y + view[2] * z + view[3];
+    clusters->view_y[i] = view[4] * x + view[5] * y + view[6] * z + view[7];
+    clusters->view_z[i] = view[8] * x + view[9] * y + view[10] * z + view[11];
+  }
+
+  job_counter_t done = {0};
+  jobs_parallel_for(cluster_slices, clusters, CLUSTER_Z, 1, &done);
+  jobs_wait(&done);
+
+  //Close the gaps between slice segments so the upload is contiguous
+  GLuint base = 0;
+  for(int slice = 0; slice < CLUSTER_Z; slice++) {
+    GLuint count = clusters->slice_counts[slice];
+    if(clusters->index_limit && base + count > clusters->index_limit) {
+      count = trim_slice(clusters, slice, clusters->index_limit - base);
+    }
+    if(base != slice * SLICE_INDEX_CAPACITY) {
+      memmove(clusters->indices + base,
+	      clusters->indices + slice * SLICE_INDEX_CAPACITY,
+	      count * sizeof(GLushort));
+      GLuint (*grid)[2] = clusters->grid + slice * CLUSTER_X * CLUSTER_Y;
+      for(int cell = 0; cell < CLUSTER_X * CLUSTER_Y; cell++) {
+	grid[cell][0] += base;
+      }
+    }
+    base += count;
+  }
+  clusters->index_count = base;
+
+  //Report when overflowing starts and stops rather than every frame
+  if(clusters->overflows) {
+    if(clusters->overflow_frames == 0) {
+      printf("[WARNING] %u light references dropped: cluster index space full\n", clusters->overflows);
+    }
+    clusters->overflow_frames++;
+    clusters->overflow_total += clusters->overflows;
+  } else if(clusters->overflow_frames) {
+    printf("[INFO] Cluster indices fit again after %u frames; %u light references dropped\n",
+	   clusters->overflow_frames, clusters->overflow_total);
+    clusters->overflow_frames = 0;
+    clusters->overflow_total = 0;
+  }
+}
+
+static void init_buffer_texture(GLuint* tbo, GLuint* tex, GLenum format) {
+  glGenBuffers(1, tbo);
+  glBindBuffer(GL_TEXTURE_BUFFER, *tbo);
+  glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+  glGenTextures(1, tex);
+  glBindTexture(GL_TEXTURE_BUFFER, *tex);
+  glTexBuffer(GL_TEXTURE_BUFFER, format, *tbo);
+}
+
+void lights_gl_init(light_clusters_t* clusters) {
+  init_buffer_texture(&clusters->light_tbo, &clusters->light_tex, GL_RGBA32F);
+  init_buffer_texture(&clusters->grid_tbo, &clusters->grid_tex, GL_RG32UI);
+  init_buffer_texture(&clusters->index_tbo, &clusters->index_tex, GL_R16UI);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  //GL 3.3 only promises 65536 texels, less than every slice's capacity together
+  GLint max_texels;
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+  //One spare texel, since the upload always sends at least one index
+  clusters->index_limit = CLUSTER_Z * SLICE_INDEX_CAPACITY;
+  if((GLuint)max_texels - 1 < clusters->index_limit) {
+    clusters->index_limit = max_texels - 1;
+    printf("[INFO] Light index buffer capped at %u entries by GL_MAX_TEXTURE_BUFFER_SIZE\n",
+	   clusters->index_limit);
+  }
+}
+
+void lights_gl_shutdown(light_clusters_t* clusters) {
+  GLuint buffers[] = {clusters->light_tbo, clusters->grid_tbo, clusters->index_tbo};
+  GLuint textures[] = {clusters->light_tex, clusters->grid_tex, clusters->index_tex};
+  glDeleteBuffers(3, buffers);
+  glDeleteTextures(3, textures);
+}
+
+void lights_upload(light_clusters_t* clusters, GLuint first_unit) {
+  const light_list_t* lights = clusters->lights;
+  //Two RGBA texels per light: position and radius, then color
+  GLfloat* light_data = arena_alloc(frame_arena(), (lights->count + 1) * 8 * sizeof(GLfloat), 16);
+  for(int i = 0; i < lights->count; i++) {
+    GLfloat* texels = light_data + i * 8;
+    texels[0] = lights->x[i];
+    texels[1] = lights->y[i];
+    texels[2] = lights->z[i];
+    texels[3] = lights->radius[i];
+    memcpy(texels + 4, lights->color[i], sizeof(GLfloat) * 3);
+    texels[7] = 0.0f;
+  }
+
+  //Respecifying the store each frame lets the driver orphan the old one
+  glBindBuffer(GL_TEXTURE_BUFFER, clusters->light_tbo);
+  glBufferData(GL_TEXTURE_BUFFER, (lights->count + 1) * 8 * sizeof(GLfloat), light_data, GL_STREAM_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, clusters->grid_tbo);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(clusters->grid), clusters->grid, GL_STREAM_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, clusters->index_tbo);
+  glBufferData(GL_TEXTURE_BUFFER, (clusters->index_count + 1) * sizeof(GLushort), clusters->indices, GL_STREAM_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  GLuint textures[] = {clusters->light_tex, clusters->grid_tex, clusters->index_tex};
+  for(int i = 0; i < 3; i++) {
+    glActiveTexture(GL_TEXTURE0 + first_unit + i);
+    glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+
+}
+
+void lights_set_uniforms(light_clusters_t* clusters, GLuint program,
+			 GLuint first_unit, GLfloat viewport_width, GLfloat viewport_height) {
+  GLint light_data_location = glGetUniformLocation(program, "light_data");
+  GLint cluster_grid_location = glGetUniformLocation(program, "cluster_grid");
+  GLint light_indices_location = glGetUniformLocation(program, "light_indices");
+  GLint cluster_dims_location = glGetUniformLocation(program, "cluster_dims");
+  GLint cluster_params_location = glGetUniformLocation(program, "cluster_params");
+
+  GLfloat log_ratio = logf(clusters->far_clip / clusters->near_clip);
+  glUniform1i(light_data_location, first_unit);
+  glUniform1i(cluster_grid_location, first_unit + 1);
+  glUniform1i(light_indices_location, first_unit + 2);
+  glUniform3ui(cluster_dims_location, CLUSTER_X, CLUSTER_Y, CLUSTER_Z);
+  //slice = log(depth) * x + y; tile = gl_FragCoord.xy / zw
+  glUniform4f(cluster_params_location,
+	      CLUSTER_Z / log_ratio,
+	      -CLUSTER_Z * logf(clusters->near_clip) / log_ratio,
+	      viewport_width / CLUSTER_X,
+	      viewport_height / CLUSTER_Y);
+}
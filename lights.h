@@ -0,0 +1,89 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <epoxy/gl.h>
+
+//View-space froxel grid: screen tiles by exponential depth slices
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+
+#define MAX_LIGHTS 4096
+//Light index capacity of each depth slice
+#define SLICE_INDEX_CAPACITY (CLUSTER_X * CLUSTER_Y * 64)
+
+/*
+ * World-space point lights, stored as structure of arrays so culling
+ * can test several lights at once.
+ */
+typedef struct {
+  int count;
+  GLfloat x[MAX_LIGHTS];
+  GLfloat y[MAX_LIGHTS];
+  GLfloat z[MAX_LIGHTS];
+  GLfloat radius[MAX_LIGHTS];
+  GLfloat color[MAX_LIGHTS][3];
+} light_list_t;
+
+typedef struct {
+  //Inputs for the current build
+  const light_list_t* lights;
+  GLfloat x_scale;
+  GLfloat y_scale;
+  GLfloat near_clip;
+  GLfloat far_clip;
+  GLfloat* view_x;
+  GLfloat* view_y;
+  GLfloat* view_z;
+
+  //Offset and count into indices for each cluster
+  GLuint grid[CLUSTER_COUNT][2];
+  GLushort indices[CLUSTER_Z * SLICE_INDEX_CAPACITY];
+  GLuint slice_counts[CLUSTER_Z];
+  GLuint index_count;
+  //Most indices the index buffer texture can hold; 0 means no limit
+  GLuint index_limit;
+  //Lights dropped because a slice ran out of index space
+  GLuint overflows;
+  //Length of the current run of overflowing builds, and its drops
+  GLuint overflow_frames;
+  GLuint overflow_total;
+
+  GLuint light_tbo;
+  GLuint light_tex;
+  GLuint grid_tbo;
+  GLuint grid_tex;
+  GLuint index_tbo;
+  GLuint index_tex;
+} light_clusters_t;
+
+int light_add(light_list_t* lights,
+	      GLfloat x, GLfloat y, GLfloat z, GLfloat radius,
+	      GLfloat r, GLfloat g, GLfloat b);
+
+/*
+ * Bins lights into clusters for the given row-major view and
+ * projection matrices.  Depth slices are spread across the job system;
+ * returns once the grid is complete.
+ */
+void lights_build_clusters(light_clusters_t* clusters, const light_list_t* lights,
+			   const GLfloat* view, const GLfloat* projection,
+			   GLfloat near_clip, GLfloat far_clip);
+
+//Also caps index_limit to what GL_MAX_TEXTURE_BUFFER_SIZE allows
+void lights_gl_init(light_clusters_t* clusters);
+void lights_gl_shutdown(light_clusters_t* clusters);
+/*
+ * Uploads lights, grid and indices as buffer textures and binds them to
+ * texture units first_unit .. first_unit + 2.
+ */
+void lights_upload(light_clusters_t* clusters, GLuint first_unit);
+/*
+ * Sets the cluster uniforms on a program using the lighting functions
+ * in frag.glsl.
+ */
+void lights_set_uniforms(light_clusters_t* clusters, GLuint program,
+			 GLuint first_unit, GLfloat viewport_width, GLfloat viewport_height);
+
+#endif
@@ -0,0 +1,69 @@
+#include "lights.h"
+#include "matrix_ops.h"
+#include "jobs.h"
+#include "arena.h"
+#include "profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define BENCH_ITERATIONS 200
+
+static light_list_t lights;
+static light_clusters_t clusters;
+
+static GLfloat random_range(GLfloat low, GLfloat high) {
+  return low + (high - low) * (rand() / (GLfloat)RAND_MAX);
+}
+
+int main(int argc, char* argv[]) {
+  int workers = argc > 1 ? atoi(argv[1]) : -1;
+  if(jobs_init(workers) < 0 || frame_arenas_init(FRAME_ARENA_SIZE) < 0) {
+    return 1;
+  }
+
+  //Camera at the origin looking down -Z, matching the main loop's clip planes
+  GLfloat view[16];
+  GLfloat projection[16];
+  set_identity4(view);
+  set_projection_matrix(projection, 1024.0f, 768.0f, M_PI_2, 1.0f, 100.0f);
+
+  printf("%8s %12s %14s %14s\n", "lights", "ms/build", "indices", "max/cluster");
+  srand(1);
+  for(int count = 64; count <= MAX_LIGHTS; count *= 2) {
+    lights.count = 0;
+    for(int i = 0; i < count; i++) {
+      light_add(&lights,
+		random_range(-60.0f, 60.0f), random_range(-10.0f, 10.0f), random_range(-100.0f, 0.0f),
+		random_range(2.0f, 6.0f),
+		1.0f, 1.0f, 1.0f);
+    }
+
+    uint64_t total_ns = 0;
+    for(int iteration = 0; iteration < BENCH_ITERATIONS + 5; iteration++) {
+      uint64_t start = profile_now_ns();
+      lights_build_clusters(&clusters, &lights, view, projection, 1.0f, 100.0f);
+      //The first few builds warm the caches and arenas
+      if(iteration >= 5) {
+	total_ns += profile_now_ns() - start;
+      }
+      frame_arenas_reset();
+    }
+
+    GLuint max_per_cluster = 0;
+    for(int cell = 0; cell < CLUSTER_COUNT; cell++) {
+      if(clusters.grid[cell][1] > max_per_cluster) {
+	max_per_cluster = clusters.grid[cell][1];
+      }
+    }
+    printf("%8d %12.4f %14u %14u%s\n",
+	   count, total_ns / 1e6 / BENCH_ITERATIONS,
+	   clusters.index_count, max_per_cluster,
+	   clusters.overflows ? " (overflowed)" : "");
+  }
+
+  frame_arenas_destroy();
+  jobs_shutdown();
+  return 0;
+}
@@ -1,6 +1,15 @@
 #include "vector_ops.h"
 #include "matrix_ops.h"
 #include "gl_ops.h"
+#include "jobs.h"
+#include "sim.h"
+#include "arena.h"
+#include "profiler.h"
+#include "lights.h"
+#include "swr.h"
+#include "pack.h"
+#include "terrain.h"
+#include "heap_count.h"
 
 #include <epoxy/gl.h>
 #include <SDL.h>
@@ -12,8 +21,35 @@
 #include <string.h>
 #include <math.h>
 #include <assert.h>
+#include <stdint.h>
+
+#define TEXTURE_PAGE_SIZE 2048
+#define TEXTURE_MAX_LAYERS 4
+
+#define NEAR_CLIP 1.0f
+#define FAR_CLIP 100.0f
+//Small colored lights circling over the ground
+#define NUM_ORBIT_LIGHTS 256
+//First texture unit used for the light cluster buffers
+#define LIGHT_TEXTURE_UNIT 1
+
+#define ASSET_PACK "glplay.pak"
+#define TERRAIN_FILE "terrain.ter"
+
+//Frames allowed to allocate while caches and arenas warm up
+#define WARMUP_FRAMES 3
+
+//--compare tolerances, on 0-255 channel values.  Filtering and
+//rasterization rules differ slightly, so the frames are never identical.
+#define COMPARE_BAD_PIXEL_ERROR 16
+#define COMPARE_MAX_MEAN_ERROR 1.0
+#define COMPARE_MAX_BAD_FRACTION 0.005
+
+#define WINDOW_WIDTH 1024
+#define WINDOW_HEIGHT 768
 
 #define CLAMP(val, minval, maxval) val = val > maxval ? maxval : (val < minval ? minval : val)
+#define CLAMP_UNIT(val) ((val) > 1.0f ? 1.0f : ((val) < 0.0f ? 0.0f : (val)))
 
 void sdl_bailout(const char* msg) {
   printf("[ERROR] %s: %s\n", SDL_GetError(), msg);
@@ -39,6 +75,231 @@ int float_eq(GLfloat f1, GLfloat f2) {
   return fabs(f1 - f2) < 0.00001f;
 }
 
+typedef struct {
+  const char* name;
+  GLuint vao;
+  const atlas_region_t* region;
+  GLsizei index_count;
+  int enable_lighting;
+  //CPU copies of the mesh for the software renderer
+  const vertex_data_t* vertices;
+  const GLuint* indices;
+
+  GLfloat position[3];
+  GLfloat scale;
+  //Rotation about the X axis
+  GLfloat angle_rad;
+
+  GLfloat model[16];
+} scene_object_t;
+
+/*
+ * Builds model = translation * rotation * scale for a range of objects.
+ * Runs on the job system; only reads and writes the objects it is given.
+ */
+void update_transforms(void* data, int start, int end) {
+  profile_zone_t zone = profile_begin("transforms");
+  scene_object_t* objects = data;
+  for(int i = start; i < end; i++) {
+    scene_object_t* obj = &objects[i];
+    GLfloat* model = obj->model;
+    set_identity4(model);
+    model[0] = obj->scale;
+    model[5] = obj->scale;
+    model[10] = obj->scale;
+    if(obj->angle_rad != 0.0f) {
+      GLfloat rotation[16];
+      set_identity4(rotation);
+      rotation[5] = cos(obj->angle_rad);
+      rotation[6] = -sin(obj->angle_rad);
+      rotation[9] = sin(obj->angle_rad);
+      rotation[10] = cos(obj->angle_rad);
+      mat_mul4(rotation, model);
+      memcpy(model, rotation, sizeof(rotation));
+    }
+    model[3] = obj->position[0];
+    model[7] = obj->position[1];
+    model[11] = obj->position[2];
+  }
+  profile_end(&zone);
+}
+
+static light_list_t scene_lights;
+static light_clusters_t light_clusters;
+static swr_context_t swr;
+static terrain_t terrain;
+
+void draw_software(scene_object_t** draw_list, int num_objects,
+		   terrain_draw_t* terrain_draws, int num_terrain_draws,
+		   const atlas_region_t* terrain_region,
+		   GLfloat* view, GLfloat* projection) {
+  swr_clear(&swr, 0.1f, 0.2f, 0.2f);
+  for(int i = 0; i < num_objects; i++) {
+    scene_object_t* obj = draw_list[i];
+    swr_draw(&swr, obj->vertices, obj->indices, obj->index_count,
+	     obj->model, view, projection,
+	     obj->region, obj->enable_lighting);
+  }
+  GLfloat identity[16];
+  set_identity4(identity);
+  for(int i = 0; i < num_terrain_draws; i++) {
+    terrain_draw_t* draw = &terrain_draws[i];
+    swr_draw(&swr, draw->vertices, draw->indices, draw->index_count,
+	     identity, view, projection, terrain_region, 1);
+  }
+  swr_flush(&swr);
+}
+
+void draw_gl(GLuint shader_program, GLuint atlas_tex,
+	     scene_object_t** draw_list, int num_objects,
+	     terrain_draw_t* terrain_draws, int num_terrain_draws,
+	     const atlas_region_t* terrain_region,
+	     GLfloat* view, GLfloat* projection) {
+  GLint sampler_uniform_location = glGetUniformLocation(shader_program, "tex");
+  GLint projection_uniform_location = glGetUniformLocation(shader_program, "projection");
+  GLint view_uniform_location = glGetUniformLocation(shader_program, "view");
+  GLint model_uniform_location = glGetUniformLocation(shader_program, "model");
+  GLint lighting_uniform_location = glGetUniformLocation(shader_program, "enable_lighting");
+
+  glUniformMatrix4fv(projection_uniform_location,
+		     1,
+		     GL_TRUE,
+		     projection);
+  glUniformMatrix4fv(view_uniform_location,
+		     1,
+		     GL_TRUE,
+		     view);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, atlas_tex);
+  glUniform1i(sampler_uniform_location, 0);
+  GLuint bound_vao = 0;
+  for(int i = 0; i < num_objects; i++) {
+    scene_object_t* obj = draw_list[i];
+    profile_zone_t draw_zone = profile_begin(obj->name);
+    profile_gpu_begin(obj->name);
+    glUniformMatrix4fv(model_uniform_location,
+		       1,
+		       GL_TRUE,
+		       obj->model);
+    glUniform1ui(lighting_uniform_location, obj->enable_lighting);
+    glVertexAttrib4fv(3, obj->region->rect);
+    glVertexAttrib1f(4, obj->region->layer);
+    if(obj->vao != bound_vao) {
+      glBindVertexArray(obj->vao);
+      bound_vao = obj->vao;
+    }
+    glDrawElements(GL_TRIANGLES, obj->index_count, GL_UNSIGNED_INT, 0);
+    profile_gpu_end();
+    profile_end(&draw_zone);
+  }
+  if(num_terrain_draws > 0) {
+    profile_zone_t terrain_zone = profile_begin("terrain");
+    profile_gpu_begin("terrain");
+    GLfloat identity[16];
+    set_identity4(identity);
+    glUniformMatrix4fv(model_uniform_location,
+		       1,
+		       GL_TRUE,
+		       identity);
+    glUniform1ui(lighting_uniform_location, 1);
+    glVertexAttrib4fv(3, terrain_region->rect);
+    glVertexAttrib1f(4, terrain_region->layer);
+    for(int i = 0; i < num_terrain_draws; i++) {
+      glBindVertexArray(terrain_draws[i].vao);
+      glDrawElements(GL_TRIANGLES, terrain_draws[i].index_count, GL_UNSIGNED_INT,
+		     terrain_draws[i].index_offset);
+    }
+    profile_gpu_end();
+    profile_end(&terrain_zone);
+  }
+  glBindVertexArray(0);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+typedef struct {
+  //Channel errors on the 0-255 scale
+  double mean_error;
+  int max_error;
+  //Share of pixels with a channel off by more than COMPARE_BAD_PIXEL_ERROR
+  double bad_fraction;
+} compare_result_t;
+
+/*
+ * Reads back the GL frame that was just drawn and measures how far the
+ * software renderer's frame is from it.
+ */
+void compare_renderers(compare_result_t* result) {
+  int pixels = swr.width * swr.height;
+  unsigned char* gl_pixels = malloc(pixels * 4);
+  glReadPixels(0, 0, swr.width, swr.height, GL_RGBA, GL_UNSIGNED_BYTE, gl_pixels);
+  unsigned char* swr_pixels = (unsigned char*)swr.color;
+  double total_error = 0.0;
+  int max_error = 0;
+  int bad_pixels = 0;
+  for(int i = 0; i < pixels; i++) {
+    int pixel_error = 0;
+    for(int ch = 0; ch < 3; ch++) {
+      int error = abs(gl_pixels[i * 4 + ch] - swr_pixels[i * 4 + ch]);
+      total_error += error;
+      pixel_error = error > pixel_error ? error : pixel_error;
+    }
+    max_error = pixel_error > max_error ? pixel_error : max_error;
+    if(pixel_error > COMPARE_BAD_PIXEL_ERROR) {
+      bad_pixels++;
+    }
+  }
+  free(gl_pixels);
+  result->mean_error = total_error / (pixels * 3.0);
+  result->max_error = max_error;
+  result->bad_fraction = (double)bad_pixels / pixels;
+}
+
+void print_comparison(const char* label, double gl_ms, double swr_ms,
+		      const compare_result_t* result) {
+  printf("[INFO] %sGL %s: %.2f ms; software: %.2f ms\n",
+	 label, glGetString(GL_RENDERER), gl_ms, swr_ms);
+  printf("[INFO] %sMean channel error %.3f, max %d, %.3f%% of pixels off by more than %d\n",
+	 label, result->mean_error, result->max_error, 100.0 * result->bad_fraction,
+	 COMPARE_BAD_PIXEL_ERROR);
+}
+
+/*
+ * Copies the software renderer's frame to the window surface.  Its rows
+ * run bottom to top like GL's, so they are flipped on the way.
+ */
+void present_software(SDL_Window* window) {
+  SDL_Surface* surface = SDL_GetWindowSurface(window);
+  if(surface == NULL) {
+    sdl_bailout("Unable to get window surface");
+  }
+  if(SDL_MUSTLOCK(surface)) {
+    SDL_LockSurface(surface);
+  }
+  int width = surface->w < swr.width ? surface->w : swr.width;
+  int height = surface->h < swr.height ? surface->h : swr.height;
+  for(int y = 0; y < height; y++) {
+    const uint32_t* src = swr.color + (size_t)(swr.height - 1 - y) * swr.width;
+    unsigned char* dst = (unsigned char*)surface->pixels + (size_t)y * surface->pitch;
+    SDL_ConvertPixels(width, 1, SDL_PIXELFORMAT_RGBA32, src, swr.width * 4,
+		      surface->format->format, dst, surface->pitch);
+  }
+  if(SDL_MUSTLOCK(surface)) {
+    SDL_UnlockSurface(surface);
+  }
+  SDL_UpdateWindowSurface(window);
+}
+
+void update_orbit_lights(light_list_t* lights, int first, double time) {
+  for(int i = 0; i < NUM_ORBIT_LIGHTS; i++) {
+    int light = first + i;
+    GLfloat ring = 1.0f + (i % 8) * 0.5f;
+    GLfloat angle = time * (0.2f + (i % 5) * 0.1f) + i * (2.0f * M_PI / NUM_ORBIT_LIGHTS) * 7.0f;
+    lights->x[light] = ring * cos(angle);
+    lights->y[light] = -0.7f + 0.2f * sin(time + i);
+    lights->z[light] = ring * sin(angle);
+  }
+}
+
 int main(int argc, char* argv[]) {
   GLfloat mat1[] = {
     1.0f, 2.0f, 3.0f, 4.0f,
@@ -72,8 +333,68 @@ int main(int argc, char* argv[]) {
   assert(float_eq(mat1[14], 20.0f));
   assert(float_eq(mat1[15], 10.0f));
 
+  arena_t test_arena;
+  int test_result = arena_init(&test_arena, 64);
+  assert(test_result == 0);
+  char* small_alloc = arena_alloc(&test_arena, 3, 1);
+  GLfloat* aligned_alloc = arena_alloc(&test_arena, sizeof(GLfloat) * 4, 16);
+  assert(small_alloc == test_arena.base);
+  assert(((uintptr_t)aligned_alloc & 15) == 0);
+  assert(arena_alloc(&test_arena, 128, 8) != NULL);
+  assert(test_arena.overflows == 1);
+  arena_reset(&test_arena);
+  assert(test_arena.used == 0);
+  //Where the aligned block lands depends on the alignment malloc gave the base
+  assert(test_arena.high_water == (size_t)((char*)aligned_alloc - small_alloc) + sizeof(GLfloat) * 4);
+  assert(arena_alloc(&test_arena, 3, 1) == small_alloc);
+  arena_destroy(&test_arena);
+
+  pool_t test_pool;
+  test_result = pool_init(&test_pool, sizeof(GLfloat) * 16, 2);
+  assert(test_result == 0);
+  void* block1 = pool_alloc(&test_pool);
+  void* block2 = pool_alloc(&test_pool);
+  assert(block1 != NULL && block2 != NULL && block1 != block2);
+  assert(pool_alloc(&test_pool) == NULL);
+  pool_free(&test_pool, block1);
+  assert(pool_alloc(&test_pool) == block1);
+  assert(test_pool.high_water == 2);
+  pool_destroy(&test_pool);
+  //Only read by the asserts above, which NDEBUG compiles out
+  (void)test_result;
+  (void)small_alloc;
+  (void)aligned_alloc;
+  (void)block2;
+
+  //--compare N renders N frames with both GL and the software renderer,
+  //then exits non-zero if they differ by more than the tolerances
+  int compare_frames = 0;
+  for(int i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+      compare_frames = atoi(argv[++i]);
+    } else {
+      printf("Usage: %s [--compare frames]\n", argv[0]);
+      return 1;
+    }
+  }
+  //The software renderer needs no GL at all, so it works without a GPU
+  const char* renderer = getenv("GLPLAY_RENDERER");
+  int software_rendering = renderer && strcmp(renderer, "software") == 0;
+  if(software_rendering && compare_frames > 0) {
+    printf("[ERROR] --compare needs GL; unset GLPLAY_RENDERER\n");
+    return 1;
+  }
+
   SDL_Window* main_window;
-  SDL_GLContext main_context;
+  SDL_GLContext main_context = NULL;
+
+  if(jobs_init(-1) < 0) {
+    printf("[ERROR] Unable to start job system\n");
+    return 1;
+  }
+  if(frame_arenas_init(FRAME_ARENA_SIZE) < 0) {
+    return 1;
+  }
 
   if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) < 0) {
     sdl_bailout("Unable to initialize SDL video/events");
@@ -83,69 +404,106 @@ int main(int argc, char* argv[]) {
     sdl_bailout("Unable to initialize SDL_image");
   }
 
-  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
-  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
-  SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
-
-  SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
-  SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
-
-  main_window = SDL_CreateWindow("glplay",
-				 SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-				 1024, 768,
-				 SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
-
-  main_context = SDL_GL_CreateContext(main_window);
-  CHECK_SDL_ERROR;
-
-  printf("[INFO] libepoxy says GL version is %d\n", epoxy_gl_version());
+  if(software_rendering) {
+    main_window = SDL_CreateWindow("glplay",
+				   SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+				   WINDOW_WIDTH, WINDOW_HEIGHT,
+				   SDL_WINDOW_SHOWN);
+    CHECK_SDL_ERROR;
+    profile_thread_name("main");
+    printf("[INFO] Rendering in software on %d threads\n", jobs_num_threads());
+  } else {
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+
+    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
+
+    main_window = SDL_CreateWindow("glplay",
+				   SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+				   WINDOW_WIDTH, WINDOW_HEIGHT,
+				   SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
+
+    main_context = SDL_GL_CreateContext(main_window);
+    CHECK_SDL_ERROR;
+
+    profile_thread_name("main");
+    profile_gpu_init();
+
+    printf("[INFO] libepoxy says GL version is %d\n", epoxy_gl_version());
+
+    GLint gl_major_version;
+    GLint gl_minor_version;
+    glGetIntegerv(GL_MAJOR_VERSION, &gl_major_version);
+    glGetIntegerv(GL_MINOR_VERSION, &gl_minor_version);
+    printf("[INFO] Using GL %d.%d\n", gl_major_version, gl_minor_version);
+    printf("[INFO] GL version string: %s\n", glGetString(GL_VERSION));
+
+    GLint max_vertex_attrs;
+    glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &max_vertex_attrs);
+    printf("[INFO] Max vertex attributes: %d\n", max_vertex_attrs);
+
+    //Compare runs time rendering, not waiting for vblank
+    SDL_GL_SetSwapInterval(compare_frames > 0 ? 0 : 1);
+    glClearColor(0.1, 0.2, 0.2, 1.0);
+    glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+    glEnable(GL_DEPTH_TEST);
+  }
 
-  GLint gl_major_version;
-  GLint gl_minor_version;
-  glGetIntegerv(GL_MAJOR_VERSION, &gl_major_version);
-  glGetIntegerv(GL_MINOR_VERSION, &gl_minor_version);
-  printf("[INFO] Using GL %d.%d\n", gl_major_version, gl_minor_version);
-  printf("[INFO] GL version string: %s\n", glGetString(GL_VERSION));
+  //Startup assets come from one mapped file when it has been built
+  asset_pack_t pack;
+  const asset_pack_t* assets = NULL;
+  if(pack_open(&pack, ASSET_PACK) == 0) {
+    assets = &pack;
+  } else {
+    printf("[WARNING] Loading assets from loose files instead of %s\n", ASSET_PACK);
+  }
 
-  GLint max_vertex_attrs;
-  glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &max_vertex_attrs);
-  printf("[INFO] Max vertex attributes: %d\n", max_vertex_attrs);
+  GLuint shader_program = 0;
+  if(!software_rendering) {
+    GLint vertex_shader = load_shader(assets, "vert.glsl", GL_VERTEX_SHADER);
+    GLint fragment_shader = load_shader(assets, "frag.glsl", GL_FRAGMENT_SHADER);
 
-  SDL_GL_SetSwapInterval(1);
-  glClearColor(0.1, 0.2, 0.2, 1.0);
-  glViewport(0, 0, 1024, 768);
-  glEnable(GL_DEPTH_TEST);
+    if(vertex_shader < 0) {
+      sdl_bailout("Failed to load vertex shader");
+    }
+    if(fragment_shader < 0) {
+      sdl_bailout("Failed to load fragment shader");
+    }
 
-  GLint vertex_shader = load_shader("vert.glsl", GL_VERTEX_SHADER);
-  GLint fragment_shader = load_shader("frag.glsl", GL_FRAGMENT_SHADER);
+    shader_program = glCreateProgram();
+    glAttachShader(shader_program, vertex_shader);
+    glAttachShader(shader_program, fragment_shader);
+    glLinkProgram(shader_program);
+    {
+      GLint success;
+      GLchar info_log[4096];
+      glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
+      if(!success) {
+	glGetProgramInfoLog(shader_program, 4096, NULL, info_log);
+	printf("[ERROR] Failed to link shader program:\n%s\n", info_log);
+	sdl_bailout("Failed to link shader program");
+      }
+    }
+    glDeleteShader(vertex_shader);
+    vertex_shader = 0;
+    glDeleteShader(fragment_shader);
+    fragment_shader = 0;
 
-  if(vertex_shader < 0) {
-    sdl_bailout("Failed to load vertex shader");
-  }
-  if(fragment_shader < 0) {
-    sdl_bailout("Failed to load fragment shader");
+    lights_gl_init(&light_clusters);
+    glUseProgram(shader_program);
   }
-
-  GLuint shader_program = glCreateProgram();
-  glAttachShader(shader_program, vertex_shader);
-  glAttachShader(shader_program, fragment_shader);
-  glLinkProgram(shader_program);
-  {
-    GLint success;
-    GLchar info_log[4096];
-    glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
-    if(!success) {
-      glGetProgramInfoLog(shader_program, 4096, NULL, info_log);
-      printf("[ERROR] Failed to link shader program:\n%s\n", info_log);
-      sdl_bailout("Failed to link shader program");
-    }
+  //The original lamp, hanging over the cube
+  light_add(&scene_lights, 1.0f, 1.0f, 1.0f, 20.0f, 1.0f, 1.0f, 1.0f);
+  int first_orbit_light = scene_lights.count;
+  for(int i = 0; i < NUM_ORBIT_LIGHTS; i++) {
+    GLfloat hue = (GLfloat)i / NUM_ORBIT_LIGHTS * 6.0f;
+    light_add(&scene_lights, 0.0f, 0.0f, 0.0f, 1.0f,
+	      0.4f * CLAMP_UNIT(fabs(hue - 3.0f) - 1.0f),
+	      0.4f * CLAMP_UNIT(2.0f - fabs(hue - 2.0f)),
+	      0.4f * CLAMP_UNIT(2.0f - fabs(hue - 4.0f)));
   }
-  glDeleteShader(vertex_shader);
-  vertex_shader = 0;
-  glDeleteShader(fragment_shader);
-  fragment_shader = 0;
-
-  glUseProgram(shader_program);
 
   vertex_data_t vertices[] = {
     { 0.5f,  0.5f, -0.5f,   0.0f, 1.0f,    0.0f,  0.0f, -1.0f},
@@ -211,60 +569,44 @@ int main(int argc, char* argv[]) {
     1, 2, 3
   };
 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-  GLuint tex = upload_texture("me.jpg");
-  GLuint white_tex = upload_texture("pure_white.png");
-
-  GLuint vbo;
-  glGenBuffers(1, &vbo);
-
-  GLuint ebo;
-  glGenBuffers(1, &ebo);
-
-  GLuint vao;
-  glGenVertexArrays(1, &vao);
-
-  glBindVertexArray(vao);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_data_t), (GLvoid*)0);
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(vertex_data_t), (GLvoid*)(3 *  sizeof(GLfloat)));
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_data_t), (GLvoid*)(5 *  sizeof(GLfloat)));
-  glEnableVertexAttribArray(2);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-  glBindVertexArray(0);
-
-  GLuint ground_tex = upload_texture("stone.png");
-
-  GLuint ground_vbo;
-  glGenBuffers(1, &ground_vbo);
-
-  GLuint ground_ebo;
-  glGenBuffers(1, &ground_ebo);
-
-  GLuint ground_vao;
-  glGenVertexArrays(1, &ground_vao);
-
-  glBindVertexArray(ground_vao);
-  glBindBuffer(GL_ARRAY_BUFFER, ground_vbo);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(ground_vertices), ground_vertices, GL_STATIC_DRAW);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_data_t), (GLvoid*)0);
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(vertex_data_t), (GLvoid*)(3 *  sizeof(GLfloat)));
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_data_t), (GLvoid*)(5 *  sizeof(GLfloat)));
-  glEnableVertexAttribArray(2);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ground_ebo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(ground_indices), ground_indices, GL_STATIC_DRAW);
-  glBindVertexArray(0);
+  //Every texture lives in one array texture, so draws never switch textures
+  texture_atlas_t atlas;
+  if(atlas_init(&atlas, TEXTURE_PAGE_SIZE, TEXTURE_MAX_LAYERS) < 0) {
+    sdl_bailout("Failed to allocate texture atlas");
+  }
+  atlas_region_t tex_region;
+  atlas_region_t white_region;
+  atlas_region_t ground_region;
+  //Only the ground repeats; white is constant, so plain padding is enough
+  if(atlas_add_texture(&atlas, assets, "me.jpg", 0, &tex_region) < 0 ||
+     atlas_add_texture(&atlas, assets, "stone.png", 1, &ground_region) < 0 ||
+     atlas_add_texture(&atlas, assets, "pure_white.png", 0, &white_region) < 0) {
+    sdl_bailout("Failed to load textures");
+  }
+  if(assets != NULL) {
+    pack_close(&pack);
+    assets = NULL;
+  }
+  GLuint atlas_tex = 0;
+  GLuint vao = 0;
+  GLuint ground_vao = 0;
+  if(!software_rendering) {
+    atlas_tex = atlas_upload(&atlas);
+    vao = upload_mesh(vertices, sizeof(vertices) / sizeof(vertex_data_t),
+		      indices, sizeof(indices) / sizeof(GLuint));
+    ground_vao = upload_mesh(ground_vertices, sizeof(ground_vertices) / sizeof(vertex_data_t),
+			     ground_indices, sizeof(ground_indices) / sizeof(GLuint));
+  }
+  //Also kept in GL mode for comparing the two renderers
+  if(swr_init(&swr, WINDOW_WIDTH, WINDOW_HEIGHT) < 0 || swr_set_atlas(&swr, &atlas) < 0) {
+    sdl_bailout("Failed to set up software renderer");
+  }
+  atlas_destroy(&atlas);
 
+  int have_terrain = terrain_open(&terrain, TERRAIN_FILE, !software_rendering) == 0;
+  if(!have_terrain) {
+    printf("[WARNING] Falling back to the flat ground plane\n");
+  }
 
   GLfloat camera_location[3] = {3.0f, 0.0f, 3.0f};
   GLfloat camera_target[3] = {0.0f, 0.0f, 0.0f};
@@ -304,38 +646,59 @@ int main(int argc, char* argv[]) {
 
   GLfloat* view = lookat;
 
-  GLfloat model_base[] = {
-    1, 0, 0, 0,
-    0, 1, 0, 0,
-    0, 0, 1, 0,
-    0, 0, 0, 1
-    };
-
-  GLfloat model_rotation[] = {
-    1, 0, 0, 0,
-    0, 1, 0, 0,
-    0, 0, 1, 0,
-    0, 0, 0, 1
+  scene_object_t objects[] = {
+    {"ground", ground_vao, &ground_region, 6, 1, ground_vertices, ground_indices,
+     {0.0f, 0.0f, 0.0f}, 1.0f, 0.0f},
+    {"cube", vao, &tex_region, sizeof(indices) / sizeof(GLuint), 1, vertices, indices,
+     {0.0f, 0.0f, 0.0f}, 1.0f, 0.0f},
+    {"light", vao, &white_region, sizeof(indices) / sizeof(GLuint), 0, vertices, indices,
+     {1.0f, 1.0f, 1.0f}, 0.1f, 0.0f}
   };
-
-  GLfloat model[16];
-
-  GLfloat camera_speed = 0.05f;
-  int moving_forward = 0;
-  int moving_backward = 0;
-  int moving_left = 0;
-  int moving_right = 0;
-  int moving_up = 0;
-  int moving_down = 0;
+  int num_objects = sizeof(objects) / sizeof(scene_object_t);
+  scene_object_t* cube_object = &objects[1];
+  //Streamed terrain replaces the flat ground when it is available
+  scene_object_t* scene = objects;
+  if(have_terrain) {
+    scene++;
+    num_objects--;
+  }
+  GLfloat identity[16];
+  set_identity4(identity);
+  //Pixels covered by one world unit at distance 1, for terrain LOD selection
+  GLfloat pixel_scale = WINDOW_HEIGHT * 0.5f / tanf(M_PI_2 * 0.5f);
+
+  sim_input_t input;
+  memset(&input, 0, sizeof(input));
+  memcpy(input.camera_look, camera_look, sizeof(input.camera_look));
+  if(sim_start(camera_location, camera_look) < 0) {
+    sdl_bailout("Failed to start simulation thread");
+  }
+  sim_state_t sim_state;
 
   GLfloat yaw = 0;
   GLfloat pitch = 0;
 
   int input_grab = 0;
-
+  int compare_pending = 0;
+  int compared_frames = 0;
+  double compare_gl_ms = 0.0;
+  double compare_swr_ms = 0.0;
+  compare_result_t compare_worst;
+  memset(&compare_worst, 0, sizeof(compare_worst));
+  int exit_status = 0;
+  GLfloat ambient_light[3] = {0.1f, 0.1f, 0.1f};
+  swr_set_lights(&swr, &light_clusters, ambient_light);
+
+  unsigned int frame_count = 0;
+  //Heap and arena-overflow counts at the end of warm-up
+  unsigned long steady_allocations = 0;
+  unsigned int steady_overflows = 0;
+  int diagnostics_ran = 0;
   int done = 0;
   SDL_Event ev;
   while(!done) {
+    profile_zone_t frame_zone = profile_begin("frame");
+    profile_zone_t events_zone = profile_begin("events");
     while(SDL_PollEvent(&ev)) {
       switch(ev.type) {
       case SDL_KEYUP:
@@ -343,6 +706,13 @@ int main(int argc, char* argv[]) {
 	case SDLK_q:
 	  done = 1;
 	  break;
+	case SDLK_c:
+	  compare_pending = !software_rendering;
+	  break;
+	case SDLK_p:
+	  profile_print_summary();
+	  profile_write_trace("glplay_trace.json");
+	  break;
 	case SDLK_e:
 	  input_grab = !input_grab;
 	  SDL_SetWindowGrab(main_window, input_grab);
@@ -350,44 +720,44 @@ int main(int argc, char* argv[]) {
 	  SDL_SetRelativeMouseMode(input_grab);
 	  break;
 	case SDLK_SPACE:
-	  moving_up = 0;
+	  input.moving_up = 0;
 	  break;
 	case SDLK_z:
-	  moving_down = 0;
+	  input.moving_down = 0;
 	  break;
 	case SDLK_w:
-	  moving_forward = 0;
+	  input.moving_forward = 0;
 	  break;
 	case SDLK_a:
-	  moving_left = 0;
+	  input.moving_left = 0;
 	  break;
 	case SDLK_s:
-	  moving_backward = 0;
+	  input.moving_backward = 0;
 	  break;
 	case SDLK_d:
-	  moving_right = 0;
+	  input.moving_right = 0;
 	  break;
 	}
 	break;
       case SDL_KEYDOWN:
 	switch(ev.key.keysym.sym) {
 	case SDLK_SPACE:
-	  moving_up = 1;
+	  input.moving_up = 1;
 	  break;
 	case SDLK_z:
-	  moving_down = 1;
+	  input.moving_down = 1;
 	  break;
 	case SDLK_w:
-	  moving_forward = 1;
+	  input.moving_forward = 1;
 	  break;
 	case SDLK_a:
-	  moving_left = 1;
+	  input.moving_left = 1;
 	  break;
 	case SDLK_s:
-	  moving_backward = 1;
+	  input.moving_backward = 1;
 	  break;
 	case SDLK_d:
-	  moving_right = 1;
+	  input.moving_right = 1;
 	  break;
 	}
 	break;
@@ -413,74 +783,33 @@ int main(int argc, char* argv[]) {
 	break;
       }
     }
+    profile_end(&events_zone);
 
-    GLfloat velocity[3];
-    if(moving_forward) {
-      memcpy(velocity, camera_look, sizeof(velocity));
-      //Negate because camera_look faces opposite of camera
-      mul_vector3(velocity, -camera_speed);
-      add_vector3(camera_location, velocity);
-    }
-    if(moving_backward) {
-      memcpy(velocity, camera_look, sizeof(velocity));
-      //Don't negate because camera_look faces opposite of camera
-      mul_vector3(velocity, camera_speed);
-      add_vector3(camera_location, velocity);
-    }
-    if(moving_right) {
-      memcpy(velocity, camera_right, sizeof(velocity));
-      mul_vector3(velocity, camera_speed);
-      add_vector3(camera_location, velocity);
-    }
-    if(moving_left) {
-      memcpy(velocity, camera_right, sizeof(velocity));
-      mul_vector3(velocity, -camera_speed);
-      add_vector3(camera_location, velocity);
+    memcpy(input.camera_look, camera_look, sizeof(input.camera_look));
+    //Compare runs keep the starting camera so they are repeatable
+    if(compare_frames == 0) {
+      sim_set_input(&input);
     }
-    if(moving_up) {
-      memcpy(velocity, camera_up, sizeof(velocity));
-      mul_vector3(velocity, camera_speed);
-      add_vector3(camera_location, velocity);
+    sim_interpolate(&sim_state);
+    memcpy(camera_location, sim_state.camera_location, sizeof(sim_state.camera_location));
+
+    if(!software_rendering) {
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      glUseProgram(shader_program);
+      glUniform1ui(glGetUniformLocation(shader_program, "time"), SDL_GetTicks());
+      glUniform3fv(glGetUniformLocation(shader_program, "ambient_light"), 1, ambient_light);
     }
-    if(moving_down) {
-      memcpy(velocity, camera_up, sizeof(velocity));
-      mul_vector3(velocity, -camera_speed);
-      add_vector3(camera_location, velocity);
-    }
-    GLint time_uniform_location = glGetUniformLocation(shader_program, "time");
-    GLint sampler_uniform_location = glGetUniformLocation(shader_program, "tex");
-    GLint projection_uniform_location = glGetUniformLocation(shader_program, "projection");
-    GLint view_uniform_location = glGetUniformLocation(shader_program, "view");
-    GLint model_uniform_location = glGetUniformLocation(shader_program, "model");
-    GLint ambient_uniform_location = glGetUniformLocation(shader_program, "ambient_light");
-    GLint diffuse_uniform_location = glGetUniformLocation(shader_program, "diffuse_light_pos");
-    GLint diffcolor_uniform_location = glGetUniformLocation(shader_program, "diffuse_light_color");
-    GLint lighting_uniform_location = glGetUniformLocation(shader_program, "enable_lighting");
-
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    glUseProgram(shader_program);
-
-    glUniform1ui(time_uniform_location, SDL_GetTicks());
-    glUniform3f(ambient_uniform_location,
-		0.1f,
-		0.1f,
-		0.1f);
-    glUniform3f(diffuse_uniform_location,
-		1.0f,
-		1.0f,
-		1.0f);
-    glUniform3f(diffcolor_uniform_location,
-		1.0f,
-		1.0f,
-		1.0f);
 
     set_projection_matrix(projection,
-			  1024.0f, 768.0f, M_PI_2,
-			  1.0f, 100.0f);
-    int enable_rotation = 1;
-    GLfloat angle_deg = SDL_GetTicks() / 20.0f;
-    GLfloat angle_rad = angle_deg / 180.0f * M_PI;
+			  WINDOW_WIDTH, WINDOW_HEIGHT, M_PI_2,
+			  NEAR_CLIP, FAR_CLIP);
+    cube_object->angle_rad = sim_state.cube_angle_rad;
+    job_counter_t transforms_done = {0};
+    jobs_parallel_for(update_transforms, scene, num_objects, 1, &transforms_done);
+    if(have_terrain) {
+      terrain_update(&terrain, camera_location);
+    }
+
     set_camera_vectors(NULL,
 		       NULL,
 		       camera_look,
@@ -488,88 +817,143 @@ int main(int argc, char* argv[]) {
 		       camera_up);
     set_lookat(lookat, camera_location, camera_right, camera_up, camera_look);
 
-    glUniformMatrix4fv(projection_uniform_location,
-		       1,
-		       GL_TRUE,
-		       projection);
-    glUniformMatrix4fv(view_uniform_location,
-		       1,
-		       GL_TRUE,
-		       view);
-
-    glUniform1ui(lighting_uniform_location, 1);
-    //ground
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, ground_tex);
-    glUniform1i(sampler_uniform_location, 0);
-
-    memcpy(model, model_base, sizeof(model_base));
-    glUniformMatrix4fv(model_uniform_location,
-		       1,
-		       GL_TRUE,
-		       model);
-
-    glBindVertexArray(ground_vao);
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-
-
-    memcpy(model, model_base, sizeof(model_base));
-    if(enable_rotation) {
-      model_rotation[5] = cos(-angle_rad);
-      model_rotation[6] = -sin(-angle_rad);
-      model_rotation[9] = sin(-angle_rad);
-      model_rotation[10] = cos(-angle_rad);
-      mat_mul4(model, model_rotation);
+    profile_zone_t lights_zone = profile_begin("light clustering");
+    update_orbit_lights(&scene_lights, first_orbit_light, sim_state.time);
+    lights_build_clusters(&light_clusters, &scene_lights, view, projection, NEAR_CLIP, FAR_CLIP);
+    if(!software_rendering) {
+      lights_upload(&light_clusters, LIGHT_TEXTURE_UNIT);
+      lights_set_uniforms(&light_clusters, shader_program, LIGHT_TEXTURE_UNIT,
+			  WINDOW_WIDTH, WINDOW_HEIGHT);
+    }
+    profile_end(&lights_zone);
+
+    //Order draws by VAO so redundant binds can be skipped
+    arena_t* arena = frame_arena();
+    scene_object_t** draw_list = arena_alloc(arena, num_objects * sizeof(scene_object_t*), 0);
+    for(int i = 0; i < num_objects; i++) {
+      scene_object_t* obj = &scene[i];
+      int j = i;
+      while(j > 0 && draw_list[j - 1]->vao > obj->vao) {
+	draw_list[j] = draw_list[j - 1];
+	j--;
+      }
+      draw_list[j] = obj;
     }
-    glUniformMatrix4fv(model_uniform_location,
-		       1,
-		       GL_TRUE,
-		       model);
-
-    glUniform1ui(lighting_uniform_location, 1);
-    //me
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glUniform1i(sampler_uniform_location, 0);
-
-    glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(GLfloat), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
 
+    terrain_draw_t* terrain_draws = NULL;
+    int num_terrain_draws = 0;
+    if(have_terrain) {
+      num_terrain_draws = terrain_select(&terrain, arena, camera_location, view, projection,
+					 pixel_scale, &terrain_draws);
+    }
 
-    memcpy(model, model_base, sizeof(model_base));
-    model[3] = 1.0f;
-    model[7] = 1.0f;
-    model[11] = 1.0f;
-    model[0] = 0.1f;
-    model[5] = 0.1f;
-    model[10] = 0.1f;
-    glUniformMatrix4fv(model_uniform_location,
-		       1,
-		       GL_TRUE,
-		       model);
-    glUniform1ui(lighting_uniform_location, 0);
-    //light
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, white_tex);
-    glUniform1i(sampler_uniform_location, 0);
+    profile_zone_t wait_zone = profile_begin("wait transforms");
+    jobs_wait(&transforms_done);
+    profile_end(&wait_zone);
+    if(compare_frames > 0) {
+      compare_pending = 1;
+    }
+    if(software_rendering) {
+      profile_zone_t swr_zone = profile_begin("software render");
+      draw_software(draw_list, num_objects, terrain_draws, num_terrain_draws, &ground_region,
+		    view, projection);
+      profile_end(&swr_zone);
+
+      profile_zone_t present_zone = profile_begin("present");
+      present_software(main_window);
+      profile_end(&present_zone);
+    } else {
+      uint64_t gl_start = 0;
+      if(compare_pending) {
+	glFinish();
+	gl_start = profile_now_ns();
+      }
+      draw_gl(shader_program, atlas_tex, draw_list, num_objects,
+	      terrain_draws, num_terrain_draws, &ground_region, view, projection);
+
+      if(compare_pending) {
+	glFinish();
+	double gl_ms = (profile_now_ns() - gl_start) / 1e6;
+	profile_zone_t swr_zone = profile_begin("software render");
+	draw_software(draw_list, num_objects, terrain_draws, num_terrain_draws, &ground_region,
+		      view, projection);
+	profile_end(&swr_zone);
+	double swr_ms = (profile_now_ns() - swr_zone.start_ns) / 1e6;
+
+	compare_result_t result;
+	compare_renderers(&result);
+	if(compare_frames == 0) {
+	  print_comparison("", gl_ms, swr_ms, &result);
+	} else {
+	  compare_gl_ms += gl_ms;
+	  compare_swr_ms += swr_ms;
+	  if(result.mean_error > compare_worst.mean_error) {
+	    compare_worst.mean_error = result.mean_error;
+	  }
+	  if(result.max_error > compare_worst.max_error) {
+	    compare_worst.max_error = result.max_error;
+	  }
+	  if(result.bad_fraction > compare_worst.bad_fraction) {
+	    compare_worst.bad_fraction = result.bad_fraction;
+	  }
+	}
+	compared_frames++;
+	compare_pending = 0;
+	diagnostics_ran = 1;
+      }
 
-    glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(GLfloat), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
+      profile_zone_t swap_zone = profile_begin("swap");
+      SDL_GL_SwapWindow(main_window);
+      profile_end(&swap_zone);
+    }
 
-    SDL_GL_SwapWindow(main_window);
+    frame_arenas_reset();
+    //Past warm-up, the frame loop must not touch the heap, either directly
+    //or by spilling out of its arenas.  Diagnostics requested from the
+    //keyboard may allocate, so they move the baseline instead.
+    frame_count++;
+    if(frame_count == WARMUP_FRAMES || diagnostics_ran) {
+      steady_allocations = heap_allocations();
+      steady_overflows = frame_arenas_overflows();
+      diagnostics_ran = 0;
+    }
+    assert(frame_count <= WARMUP_FRAMES || heap_allocations() == steady_allocations);
+    assert(frame_count <= WARMUP_FRAMES || frame_arenas_overflows() == steady_overflows);
+    profile_end(&frame_zone);
+    profile_frame_end();
+
+    if(compare_frames > 0 && compared_frames == compare_frames) {
+      compare_gl_ms /= compared_frames;
+      compare_swr_ms /= compared_frames;
+      print_comparison("Worst of run: ", compare_gl_ms, compare_swr_ms, &compare_worst);
+      if(compare_worst.mean_error > COMPARE_MAX_MEAN_ERROR ||
+	 compare_worst.bad_fraction > COMPARE_MAX_BAD_FRACTION) {
+	printf("[ERROR] Renderers differ by more than mean error %.2f or %.2f%% bad pixels\n",
+	       COMPARE_MAX_MEAN_ERROR, 100.0 * COMPARE_MAX_BAD_FRACTION);
+	exit_status = 1;
+      }
+      done = 1;
+    }
+  }
+  printf("[INFO] Frame arena high-water mark: %zu bytes over %u frames\n",
+	 frame_arenas_high_water(), frame_count);
+  printf("[INFO] Since warm-up: %lu heap allocations, %u arena overflows\n",
+	 heap_allocations() - steady_allocations, frame_arenas_overflows() - steady_overflows);
+
+  sim_stop();
+  if(have_terrain) {
+    terrain_close(&terrain);
+  }
+  swr_destroy(&swr);
+  if(!software_rendering) {
+    lights_gl_shutdown(&light_clusters);
+    profile_gpu_shutdown();
+    SDL_GL_DeleteContext(main_context);
   }
-
-  SDL_GL_DeleteContext(main_context);
   SDL_DestroyWindow(main_window);
   IMG_Quit();
   SDL_Quit();
-  return 0;
+  frame_arenas_destroy();
+  jobs_shutdown();
+  return exit_status;
 }
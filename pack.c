@@ -0,0 +1,199 @@
+#include "pack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef GLPLAY_PACK_LZ4
+#include <lz4.h>
+#endif
+
+static uint32_t crc_table[256];
+static int crc_table_ready = 0;
+
+static void build_crc_table(void) {
+  for(uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for(int bit = 0; bit < 8; bit++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+    }
+    crc_table[i] = crc;
+  }
+  crc_table_ready = 1;
+}
+
+uint32_t pack_crc32(const void* data, size_t size) {
+  if(!crc_table_ready) {
+    build_crc_table();
+  }
+  const unsigned char* bytes = data;
+  uint32_t crc = 0xFFFFFFFFu;
+  for(size_t i = 0; i < size; i++) {
+    crc = crc_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc ^ 0xFFFFFFFFu;
+}
+
+static int validate_pack(const asset_pack_t* pack, const char* filename) {
+  if(pack->size < sizeof(pack_header_t)) {
+    printf("[ERROR] Pack %s is too small to have a header\n", filename);
+    return -1;
+  }
+  const pack_header_t* header = (const pack_header_t*)pack->base;
+  if(memcmp(header->magic, PACK_MAGIC, 4) != 0) {
+    printf("[ERROR] %s is not an asset pack\n", filename);
+    return -1;
+  }
+  if(header->version != PACK_VERSION) {
+    printf("[ERROR] Pack %s has version %u, expected %d\n",
+	   filename, header->version, PACK_VERSION);
+    return -1;
+  }
+  uint64_t toc_end = sizeof(pack_header_t) + (uint64_t)header->entry_count * sizeof(pack_entry_t);
+  if(toc_end > pack->size || header->data_offset < toc_end || header->data_offset > pack->size) {
+    printf("[ERROR] Pack %s has a truncated table of contents\n", filename);
+    return -1;
+  }
+
+  const pack_entry_t* entries = (const pack_entry_t*)(pack->base + sizeof(pack_header_t));
+  for(uint32_t i = 0; i < header->entry_count; i++) {
+    const pack_entry_t* entry = &entries[i];
+    if(memchr(entry->name, '\0', PACK_MAX_NAME) == NULL) {
+      printf("[ERROR] Pack %s entry %u has an unterminated name\n", filename, i);
+      return -1;
+    }
+    if(i > 0 && strcmp(entries[i - 1].name, entry->name) >= 0) {
+      printf("[ERROR] Pack %s table of contents is not sorted at %s\n", filename, entry->name);
+      return -1;
+    }
+    if(entry->offset < header->data_offset ||
+       entry->offset + entry->stored_size > pack->size) {
+      printf("[ERROR] Pack %s entry %s lies outside the file\n", filename, entry->name);
+      return -1;
+    }
+    if(!(entry->flags & PACK_ENTRY_LZ4) && entry->size != entry->stored_size) {
+      printf("[ERROR] Pack %s entry %s has mismatched sizes\n", filename, entry->name);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int pack_open(asset_pack_t* pack, const char* filename) {
+  memset(pack, 0, sizeof(asset_pack_t));
+  pack->fd = open(filename, O_RDONLY);
+  if(pack->fd < 0) {
+    printf("[ERROR] Unable to open pack %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+
+  struct stat file_stat;
+  if(fstat(pack->fd, &file_stat) < 0) {
+    printf("[ERROR] Unable to stat pack %s: %s\n", filename, strerror(errno));
+    pack_close(pack);
+    return -1;
+  }
+  pack->size = file_stat.st_size;
+  if(pack->size == 0) {
+    printf("[ERROR] Pack %s is empty\n", filename);
+    pack_close(pack);
+    return -1;
+  }
+
+  void* mapping = mmap(NULL, pack->size, PROT_READ, MAP_PRIVATE, pack->fd, 0);
+  if(mapping == MAP_FAILED) {
+    printf("[ERROR] Unable to map pack %s: %s\n", filename, strerror(errno));
+    pack_close(pack);
+    return -1;
+  }
+  pack->base = mapping;
+  //Everything in the pack is needed at startup, so start reading it all now
+  madvise(mapping, pack->size, MADV_WILLNEED);
+
+  if(validate_pack(pack, filename) < 0) {
+    pack_close(pack);
+    return -1;
+  }
+  const pack_header_t* header = (const pack_header_t*)pack->base;
+  pack->entries = (const pack_entry_t*)(pack->base + sizeof(pack_header_t));
+  pack->entry_count = header->entry_count;
+  printf("[INFO] Mapped pack %s: %u entries, %zu bytes\n",
+	 filename, pack->entry_count, pack->size);
+  return 0;
+}
+
+void pack_close(asset_pack_t* pack) {
+  if(pack->base != NULL) {
+    munmap((void*)pack->base, pack->size);
+  }
+  if(pack->fd >= 0) {
+    close(pack->fd);
+  }
+  memset(pack, 0, sizeof(asset_pack_t));
+  pack->fd = -1;
+}
+
+const pack_entry_t* pack_find(const asset_pack_t* pack, const char* name) {
+  uint32_t low = 0;
+  uint32_t high = pack->entry_count;
+  while(low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    int order = strcmp(name, pack->entries[mid].name);
+    if(order == 0) {
+      return &pack->entries[mid];
+    }
+    if(order < 0) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+  return NULL;
+}
+
+int pack_get(const asset_pack_t* pack, const char* name, pack_blob_t* blob) {
+  memset(blob, 0, sizeof(pack_blob_t));
+  const pack_entry_t* entry = pack_find(pack, name);
+  if(entry == NULL) {
+    printf("[ERROR] No entry %s in asset pack\n", name);
+    return -1;
+  }
+  const unsigned char* stored = pack->base + entry->offset;
+  if(pack_crc32(stored, entry->stored_size) != entry->crc32) {
+    printf("[ERROR] Checksum mismatch for pack entry %s\n", name);
+    return -1;
+  }
+
+  if(!(entry->flags & PACK_ENTRY_LZ4)) {
+    blob->data = stored;
+    blob->size = entry->size;
+    return 0;
+  }
+
+#ifdef GLPLAY_PACK_LZ4
+  blob->owned = malloc(entry->size);
+  int decoded = LZ4_decompress_safe((const char*)stored, blob->owned,
+				    entry->stored_size, entry->size);
+  if(decoded < 0 || (uint32_t)decoded != entry->size) {
+    printf("[ERROR] Failed to decompress pack entry %s\n", name);
+    pack_release(blob);
+    return -1;
+  }
+  blob->data = blob->owned;
+  blob->size = entry->size;
+  return 0;
+#else
+  printf("[ERROR] Pack entry %s is LZ4 compressed; rebuild with -DGLPLAY_PACK_LZ4\n", name);
+  return -1;
+#endif
+}
+
+void pack_release(pack_blob_t* blob) {
+  free(blob->owned);
+  memset(blob, 0, sizeof(pack_blob_t));
+}
@@ -0,0 +1,73 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PACK_MAGIC "GLPK"
+#define PACK_VERSION 1
+//Entry data starts on this boundary so mapped assets can be used in place
+#define PACK_ALIGNMENT 64
+#define PACK_MAX_NAME 56
+
+#define PACK_ENTRY_LZ4 0x1
+
+/*
+ * On-disk layout, little-endian: a pack_header_t, then entry_count
+ * pack_entry_t records sorted by name, then the entry data.
+ */
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t entry_count;
+  uint32_t flags;
+  uint64_t data_offset;
+} pack_header_t;
+
+typedef struct {
+  char name[PACK_MAX_NAME];
+  uint64_t offset;
+  //Bytes stored in the pack, and bytes after decompression
+  uint32_t stored_size;
+  uint32_t size;
+  //CRC-32 of the stored bytes
+  uint32_t crc32;
+  uint32_t flags;
+} pack_entry_t;
+
+/*
+ * A pack file mapped read-only for the life of the program.
+ */
+typedef struct {
+  int fd;
+  const unsigned char* base;
+  size_t size;
+  const pack_entry_t* entries;
+  uint32_t entry_count;
+} asset_pack_t;
+
+/*
+ * Bytes of one entry.  Uncompressed entries point straight into the
+ * mapping; compressed ones are decoded into a heap buffer that
+ * pack_release() frees.
+ */
+typedef struct {
+  const void* data;
+  size_t size;
+  void* owned;
+} pack_blob_t;
+
+int pack_open(asset_pack_t* pack, const char* filename);
+void pack_close(asset_pack_t* pack);
+//Binary search of the table of contents; NULL if the name is not present
+const pack_entry_t* pack_find(const asset_pack_t* pack, const char* name);
+/*
+ * Looks up an entry, checks its CRC and decompresses it if needed.
+ * Returns -1 if the entry is missing or damaged.
+ */
+int pack_get(const asset_pack_t* pack, const char* name, pack_blob_t* blob);
+void pack_release(pack_blob_t* blob);
+
+uint32_t pack_crc32(const void* data, size_t size);
+
+#endif
@@ -0,0 +1,175 @@
+/*
+ * Builds an asset pack for glplay.
+ *
+ * Usage: packtool [-z] output.pak file...
+ *
+ * Entries are named by the paths given on the command line.  With -z,
+ * entries that LZ4 shrinks are stored compressed (needs a build with
+ * -DGLPLAY_PACK_LZ4); everything else stays uncompressed so it can be
+ * used straight out of the mapping.
+ */
+#include "pack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef GLPLAY_PACK_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+typedef struct {
+  pack_entry_t entry;
+  unsigned char* data;
+} input_file_t;
+
+static unsigned char* read_whole_file(const char* filename, size_t* size) {
+  FILE* file = fopen(filename, "rb");
+  if(file == NULL) {
+    printf("[ERROR] Unable to open %s: %s\n", filename, strerror(errno));
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if(length < 0) {
+    printf("[ERROR] Unable to size %s: %s\n", filename, strerror(errno));
+    fclose(file);
+    return NULL;
+  }
+  unsigned char* data = malloc(length > 0 ? length : 1);
+  if(fread(data, 1, length, file) != (size_t)length) {
+    printf("[ERROR] Failed reading %s\n", filename);
+    free(data);
+    fclose(file);
+    return NULL;
+  }
+  fclose(file);
+  *size = length;
+  return data;
+}
+
+#ifdef GLPLAY_PACK_LZ4
+static void try_compress(input_file_t* input) {
+  int bound = LZ4_compressBound(input->entry.size);
+  unsigned char* compressed = malloc(bound);
+  int compressed_size = LZ4_compress_HC((const char*)input->data, (char*)compressed,
+					input->entry.size, bound, LZ4HC_CLEVEL_MAX);
+  if(compressed_size <= 0 || (uint32_t)compressed_size >= input->entry.size) {
+    free(compressed);
+    return;
+  }
+  free(input->data);
+  input->data = compressed;
+  input->entry.stored_size = compressed_size;
+  input->entry.flags |= PACK_ENTRY_LZ4;
+}
+#endif
+
+static int compare_inputs(const void* a, const void* b) {
+  return strcmp(((const input_file_t*)a)->entry.name, ((const input_file_t*)b)->entry.name);
+}
+
+static uint64_t align_offset(uint64_t offset) {
+  return (offset + PACK_ALIGNMENT - 1) & ~(uint64_t)(PACK_ALIGNMENT - 1);
+}
+
+int main(int argc, char** argv) {
+  int compress = 0;
+  int first_arg = 1;
+  if(argc > 1 && strcmp(argv[1], "-z") == 0) {
+    compress = 1;
+    first_arg++;
+  }
+  if(argc - first_arg < 2) {
+    printf("Usage: %s [-z] output.pak file...\n", argv[0]);
+    return 1;
+  }
+#ifndef GLPLAY_PACK_LZ4
+  if(compress) {
+    printf("[WARNING] Built without -DGLPLAY_PACK_LZ4; storing everything uncompressed\n");
+    compress = 0;
+  }
+#endif
+
+  const char* output_name = argv[first_arg];
+  int num_inputs = argc - first_arg - 1;
+  input_file_t* inputs = calloc(num_inputs, sizeof(input_file_t));
+  for(int i = 0; i < num_inputs; i++) {
+    const char* filename = argv[first_arg + 1 + i];
+    if(strlen(filename) >= PACK_MAX_NAME) {
+      printf("[ERROR] Name %s is longer than %d bytes\n", filename, PACK_MAX_NAME - 1);
+      return 1;
+    }
+    size_t size;
+    inputs[i].data = read_whole_file(filename, &size);
+    if(inputs[i].data == NULL) {
+      return 1;
+    }
+    if(size > UINT32_MAX) {
+      printf("[ERROR] %s is too big for a pack entry\n", filename);
+      return 1;
+    }
+    strcpy(inputs[i].entry.name, filename);
+    inputs[i].entry.size = size;
+    inputs[i].entry.stored_size = size;
+#ifdef GLPLAY_PACK_LZ4
+    if(compress) {
+      try_compress(&inputs[i]);
+    }
+#endif
+    inputs[i].entry.crc32 = pack_crc32(inputs[i].data, inputs[i].entry.stored_size);
+  }
+
+  //The reader binary searches the table of contents
+  qsort(inputs, num_inputs, sizeof(input_file_t), compare_inputs);
+  for(int i = 1; i < num_inputs; i++) {
+    if(strcmp(inputs[i - 1].entry.name, inputs[i].entry.name) == 0) {
+      printf("[ERROR] %s given more than once\n", inputs[i].entry.name);
+      return 1;
+    }
+  }
+
+  pack_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PACK_MAGIC, 4);
+  header.version = PACK_VERSION;
+  header.entry_count = num_inputs;
+  header.data_offset = align_offset(sizeof(pack_header_t) + num_inputs * sizeof(pack_entry_t));
+  uint64_t offset = header.data_offset;
+  for(int i = 0; i < num_inputs; i++) {
+    inputs[i].entry.offset = offset;
+    offset = align_offset(offset + inputs[i].entry.stored_size);
+  }
+
+  FILE* output = fopen(output_name, "wb");
+  if(output == NULL) {
+    printf("[ERROR] Unable to create %s: %s\n", output_name, strerror(errno));
+    return 1;
+  }
+  static const unsigned char padding[PACK_ALIGNMENT];
+  fwrite(&header, sizeof(header), 1, output);
+  for(int i = 0; i < num_inputs; i++) {
+    fwrite(&inputs[i].entry, sizeof(pack_entry_t), 1, output);
+  }
+  long position = ftell(output);
+  fwrite(padding, 1, header.data_offset - position, output);
+  for(int i = 0; i < num_inputs; i++) {
+    pack_entry_t* entry = &inputs[i].entry;
+    fwrite(inputs[i].data, 1, entry->stored_size, output);
+    uint64_t end = entry->offset + entry->stored_size;
+    fwrite(padding, 1, align_offset(end) - end, output);
+    printf("[INFO] %-24s %8u bytes%s\n", entry->name, entry->size,
+	   entry->flags & PACK_ENTRY_LZ4 ? " (lz4)" : "");
+    free(inputs[i].data);
+  }
+  if(fclose(output) != 0) {
+    printf("[ERROR] Failed writing %s: %s\n", output_name, strerror(errno));
+    return 1;
+  }
+  printf("[INFO] Wrote %s: %d entries, %lu bytes\n", output_name, num_inputs, (unsigned long)offset);
+  free(inputs);
+  return 0;
+}
@@ -0,0 +1,352 @@
+#include "profiler.h"
+
+#include <epoxy/gl.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+  const char* name;
+  uint64_t start_ns;
+  uint64_t end_ns;
+} profile_event_t;
+
+/*
+ * Written only by its owning thread.  The GL thread reads behind head
+ * to build summaries and traces; a thread that laps the reader simply
+ * loses its oldest events.
+ */
+typedef struct {
+  char name[32];
+  int tid;
+  uint64_t head;
+  uint64_t summarized;
+  profile_event_t events[PROFILE_RING_SIZE];
+} profile_ring_t;
+
+typedef struct {
+  const char* name;
+
+  uint64_t cpu_ns;
+  uint64_t cpu_max_ns;
+  unsigned int cpu_calls;
+  uint64_t gpu_ns;
+  unsigned int gpu_calls;
+
+  //Per-frame figures from the last completed summary window
+  double cpu_avg_ms;
+  double cpu_max_ms;
+  double gpu_avg_ms;
+  double calls_per_frame;
+} zone_stats_t;
+
+typedef struct {
+  int count;
+  const char* names[PROFILE_MAX_GPU_ZONES];
+  GLuint queries[PROFILE_MAX_GPU_ZONES * 2];
+} gpu_frame_t;
+
+static profile_ring_t rings[PROFILE_MAX_THREADS];
+//Slots handed out, and the leading slots that are initialized and readable
+static int claimed_rings = 0;
+static int ready_rings = 0;
+//Cached by threads that found every slot taken, so they stop trying
+static char no_ring_sentinel;
+#define NO_RING ((profile_ring_t*)&no_ring_sentinel)
+static __thread profile_ring_t* thread_ring = NULL;
+static __thread const char* pending_thread_name = NULL;
+
+//GPU zones get their own track in traces
+static profile_ring_t gpu_ring;
+static gpu_frame_t gpu_frames[PROFILE_GPU_LATENCY];
+static unsigned int gpu_frame = 0;
+static int gpu_enabled = 0;
+static int gpu_open = 0;
+static int64_t gpu_to_cpu_ns = 0;
+static unsigned int gpu_dropped = 0;
+
+static zone_stats_t zones[PROFILE_MAX_ZONES];
+static int num_zones = 0;
+static unsigned int summary_frames = 0;
+static unsigned int summary_window = 0;
+
+static uint64_t trace_base_ns = 0;
+
+uint64_t profile_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static profile_ring_t* get_thread_ring(void) {
+  if(thread_ring) {
+    return thread_ring == NO_RING ? NULL : thread_ring;
+  }
+  int index = __atomic_load_n(&claimed_rings, __ATOMIC_RELAXED);
+  do {
+    if(index >= PROFILE_MAX_THREADS) {
+      thread_ring = NO_RING;
+      return NULL;
+    }
+  } while(!__atomic_compare_exchange_n(&claimed_rings, &index, index + 1, 1,
+				       __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  profile_ring_t* ring = &rings[index];
+  ring->tid = index + 1;
+  if(pending_thread_name) {
+    snprintf(ring->name, sizeof(ring->name), "%s", pending_thread_name);
+  } else {
+    snprintf(ring->name, sizeof(ring->name), "thread %d", ring->tid);
+  }
+  //Readers take every ring below ready_rings, so slots are published in order
+  int expected = index;
+  while(!__atomic_compare_exchange_n(&ready_rings, &expected, index + 1, 1,
+				     __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    expected = index;
+  }
+  thread_ring = ring;
+  return ring;
+}
+
+void profile_thread_name(const char* name) {
+  pending_thread_name = name;
+  if(thread_ring && thread_ring != NO_RING) {
+    snprintf(thread_ring->name, sizeof(thread_ring->name), "%s", name);
+  }
+}
+
+static void ring_push(profile_ring_t* ring, const char* name, uint64_t start_ns, uint64_t end_ns) {
+  uint64_t head = ring->head;
+  profile_event_t* ev = &ring->events[head % PROFILE_RING_SIZE];
+  ev->name = name;
+  ev->start_ns = start_ns;
+  ev->end_ns = end_ns;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+profile_zone_t profile_begin(const char* name) {
+  profile_zone_t zone = { name, profile_now_ns() };
+  return zone;
+}
+
+void profile_end(profile_zone_t* zone) {
+  uint64_t end_ns = profile_now_ns();
+  profile_ring_t* ring = get_thread_ring();
+  if(ring) {
+    ring_push(ring, zone->name, zone->start_ns, end_ns);
+  }
+}
+
+static void calibrate_gpu_clock(void) {
+  GLint64 gpu_now;
+  glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+  gpu_to_cpu_ns = (int64_t)profile_now_ns() - gpu_now;
+}
+
+int profile_gpu_init(void) {
+  GLint bits = 0;
+  glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+  if(bits == 0) {
+    printf("[WARNING] GL timestamp queries unsupported; GPU zones disabled\n");
+    return -1;
+  }
+  for(int i = 0; i < PROFILE_GPU_LATENCY; i++) {
+    glGenQueries(PROFILE_MAX_GPU_ZONES * 2, gpu_frames[i].queries);
+    gpu_frames[i].count = 0;
+  }
+  snprintf(gpu_ring.name, sizeof(gpu_ring.name), "GPU");
+  gpu_ring.tid = PROFILE_MAX_THREADS + 1;
+  calibrate_gpu_clock();
+  gpu_enabled = 1;
+  return 0;
+}
+
+void profile_gpu_shutdown(void) {
+  if(!gpu_enabled) {
+    return;
+  }
+  for(int i = 0; i < PROFILE_GPU_LATENCY; i++) {
+    glDeleteQueries(PROFILE_MAX_GPU_ZONES * 2, gpu_frames[i].queries);
+  }
+  gpu_enabled = 0;
+}
+
+void profile_gpu_begin(const char* name) {
+  gpu_frame_t* frame = &gpu_frames[gpu_frame % PROFILE_GPU_LATENCY];
+  if(!gpu_enabled || frame->count >= PROFILE_MAX_GPU_ZONES) {
+    return;
+  }
+  frame->names[frame->count] = name;
+  glQueryCounter(frame->queries[frame->count * 2], GL_TIMESTAMP);
+  gpu_open = 1;
+}
+
+void profile_gpu_end(void) {
+  gpu_frame_t* frame = &gpu_frames[gpu_frame % PROFILE_GPU_LATENCY];
+  if(!gpu_open) {
+    return;
+  }
+  glQueryCounter(frame->queries[frame->count * 2 + 1], GL_TIMESTAMP);
+  frame->count++;
+  gpu_open = 0;
+}
+
+static zone_stats_t* find_zone(const char* name) {
+  for(int i = 0; i < num_zones; i++) {
+    if(zones[i].name == name || strcmp(zones[i].name, name) == 0) {
+      return &zones[i];
+    }
+  }
+  if(num_zones >= PROFILE_MAX_ZONES) {
+    return NULL;
+  }
+  zone_stats_t* zone = &zones[num_zones++];
+  memset(zone, 0, sizeof(zone_stats_t));
+  zone->name = name;
+  return zone;
+}
+
+/*
+ * Reads back the oldest frame's queries so its slot can be reused.
+ * Results that still are not ready after PROFILE_GPU_LATENCY frames are
+ * dropped rather than stalling the pipeline.
+ */
+static void collect_gpu_frame(gpu_frame_t* frame) {
+  if(frame->count == 0) {
+    return;
+  }
+  GLuint available = 0;
+  glGetQueryObjectuiv(frame->queries[frame->count * 2 - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+  if(!available) {
+    gpu_dropped += frame->count;
+    frame->count = 0;
+    return;
+  }
+  for(int i = 0; i < frame->count; i++) {
+    GLuint64 start;
+    GLuint64 end;
+    glGetQueryObjectui64v(frame->queries[i * 2], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(frame->queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+    ring_push(&gpu_ring, frame->names[i], start + gpu_to_cpu_ns, end + gpu_to_cpu_ns);
+    zone_stats_t* zone = find_zone(frame->names[i]);
+    if(zone) {
+      zone->gpu_ns += end - start;
+      zone->gpu_calls++;
+    }
+  }
+  frame->count = 0;
+}
+
+static void summarize_ring(profile_ring_t* ring) {
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  if(head - ring->summarized > PROFILE_RING_SIZE) {
+    ring->summarized = head - PROFILE_RING_SIZE;
+  }
+  for(; ring->summarized < head; ring->summarized++) {
+    profile_event_t* ev = &ring->events[ring->summarized % PROFILE_RING_SIZE];
+    zone_stats_t* zone = find_zone(ev->name);
+    if(zone == NULL) {
+      continue;
+    }
+    uint64_t duration = ev->end_ns - ev->start_ns;
+    zone->cpu_ns += duration;
+    zone->cpu_calls++;
+    if(duration > zone->cpu_max_ns) {
+      zone->cpu_max_ns = duration;
+    }
+  }
+}
+
+void profile_frame_end(void) {
+  if(trace_base_ns == 0) {
+    trace_base_ns = profile_now_ns();
+  }
+  if(gpu_enabled) {
+    gpu_frame++;
+    collect_gpu_frame(&gpu_frames[gpu_frame % PROFILE_GPU_LATENCY]);
+  }
+
+  int rings_in_use = __atomic_load_n(&ready_rings, __ATOMIC_ACQUIRE);
+  for(int i = 0; i < rings_in_use; i++) {
+    summarize_ring(&rings[i]);
+  }
+
+  if(++summary_frames < PROFILE_SUMMARY_FRAMES) {
+    return;
+  }
+  for(int i = 0; i < num_zones; i++) {
+    zone_stats_t* zone = &zones[i];
+    zone->cpu_avg_ms = zone->cpu_ns / 1e6 / summary_frames;
+    zone->cpu_max_ms = zone->cpu_max_ns / 1e6;
+    zone->gpu_avg_ms = zone->gpu_ns / 1e6 / summary_frames;
+    zone->calls_per_frame = (double)zone->cpu_calls / summary_frames;
+    zone->cpu_ns = 0;
+    zone->cpu_max_ns = 0;
+    zone->cpu_calls = 0;
+    zone->gpu_ns = 0;
+    zone->gpu_calls = 0;
+  }
+  summary_frames = 0;
+  summary_window++;
+  if(gpu_enabled) {
+    //The GPU and CPU clocks drift apart; keep the trace tracks lined up
+    calibrate_gpu_clock();
+  }
+}
+
+void profile_print_summary(void) {
+  if(summary_window == 0) {
+    printf("[INFO] Profiler summary not ready; need %d frames\n", PROFILE_SUMMARY_FRAMES);
+    return;
+  }
+  printf("[INFO] Profile over last %d frames (ms per frame):\n", PROFILE_SUMMARY_FRAMES);
+  printf("  %-20s %9s %9s %9s %7s\n", "zone", "cpu avg", "cpu max", "gpu avg", "calls");
+  for(int i = 0; i < num_zones; i++) {
+    zone_stats_t* zone = &zones[i];
+    printf("  %-20s %9.3f %9.3f %9.3f %7.1f\n",
+	   zone->name, zone->cpu_avg_ms, zone->cpu_max_ms,
+	   zone->gpu_avg_ms, zone->calls_per_frame);
+  }
+  if(gpu_dropped) {
+    printf("  (%u GPU zones dropped: results not ready in time)\n", gpu_dropped);
+  }
+}
+
+static void write_ring(FILE* out, profile_ring_t* ring, int first) {
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint64_t start = head > PROFILE_RING_SIZE ? head - PROFILE_RING_SIZE : 0;
+  fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+	  "\"args\":{\"name\":\"%s\"}}",
+	  first ? "" : ",\n", ring->tid, ring->name);
+  for(uint64_t i = start; i < head; i++) {
+    profile_event_t* ev = &ring->events[i % PROFILE_RING_SIZE];
+    if(ev->start_ns < trace_base_ns) {
+      continue;
+    }
+    fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+	    "\"ts\":%.3f,\"dur\":%.3f}",
+	    ev->name, ring->tid,
+	    (ev->start_ns - trace_base_ns) / 1e3,
+	    (ev->end_ns - ev->start_ns) / 1e3);
+  }
+}
+
+int profile_write_trace(const char* filename) {
+  FILE* out = fopen(filename, "w");
+  if(out == NULL) {
+    printf("[ERROR] Unable to open trace file %s\n", filename);
+    return -1;
+  }
+  fprintf(out, "{\"traceEvents\":[\n");
+  int rings_in_use = __atomic_load_n(&ready_rings, __ATOMIC_ACQUIRE);
+  for(int i = 0; i < rings_in_use; i++) {
+    write_ring(out, &rings[i], i == 0);
+  }
+  if(gpu_enabled) {
+    write_ring(out, &gpu_ring, rings_in_use == 0);
+  }
+  fprintf(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  fclose(out);
+  printf("[INFO] Wrote Chrome trace to %s\n", filename);
+  return 0;
+}
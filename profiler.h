@@ -0,0 +1,53 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+#define PROFILE_MAX_THREADS 40
+#define PROFILE_RING_SIZE 8192
+#define PROFILE_MAX_ZONES 64
+#define PROFILE_MAX_GPU_ZONES 32
+//GPU results are read back this many frames after they were issued
+#define PROFILE_GPU_LATENCY 4
+//Frames averaged together for each summary
+#define PROFILE_SUMMARY_FRAMES 120
+
+/*
+ * Zone names must be string literals (or otherwise outlive the
+ * profiler); only the pointer is recorded.
+ */
+typedef struct {
+  const char* name;
+  uint64_t start_ns;
+} profile_zone_t;
+
+uint64_t profile_now_ns(void);
+
+/*
+ * Names the calling thread in traces.  Threads that record zones
+ * without calling this show up as "thread N".
+ */
+void profile_thread_name(const char* name);
+
+profile_zone_t profile_begin(const char* name);
+void profile_end(profile_zone_t* zone);
+
+/*
+ * GPU zones are timed with GL_TIMESTAMP queries.  They must be issued
+ * from the GL context thread and must not nest.
+ */
+int profile_gpu_init(void);
+void profile_gpu_shutdown(void);
+void profile_gpu_begin(const char* name);
+void profile_gpu_end(void);
+
+/*
+ * Call once per frame on the GL context thread, after the swap.
+ * Collects finished GPU queries and folds the frame into the summary.
+ */
+void profile_frame_end(void);
+
+void profile_print_summary(void);
+int profile_write_trace(const char* filename);
+
+#endif
@@ -0,0 +1,181 @@
+#include "sim.h"
+#include "vector_ops.h"
+#include "matrix_ops.h"
+#include "profiler.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+static pthread_t sim_thread;
+static int sim_running = 0;
+
+static pthread_mutex_t input_mutex = PTHREAD_MUTEX_INITIALIZER;
+static sim_input_t shared_input;
+
+//Double-buffered snapshots: the renderer blends previous into current
+static pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static sim_state_t snapshots[2];
+static int current_snapshot = 0;
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void move_camera(GLfloat* camera_location, GLfloat* direction, GLfloat distance) {
+  GLfloat velocity[3];
+  memcpy(velocity, direction, sizeof(velocity));
+  mul_vector3(velocity, distance);
+  add_vector3(camera_location, velocity);
+}
+
+static void sim_tick(sim_state_t* state, const sim_input_t* input, double dt) {
+  GLfloat camera_look[3];
+  GLfloat camera_right[3];
+  GLfloat camera_up[3];
+  memcpy(camera_look, input->camera_look, sizeof(camera_look));
+  set_camera_vectors(NULL,
+		     NULL,
+		     camera_look,
+		     camera_right,
+		     camera_up);
+
+  GLfloat step = SIM_CAMERA_SPEED * dt;
+  //camera_look faces opposite of camera, so forward is negative
+  if(input->moving_forward) {
+    move_camera(state->camera_location, camera_look, -step);
+  }
+  if(input->moving_backward) {
+    move_camera(state->camera_location, camera_look, step);
+  }
+  if(input->moving_right) {
+    move_camera(state->camera_location, camera_right, step);
+  }
+  if(input->moving_left) {
+    move_camera(state->camera_location, camera_right, -step);
+  }
+  if(input->moving_up) {
+    move_camera(state->camera_location, camera_up, step);
+  }
+  if(input->moving_down) {
+    move_camera(state->camera_location, camera_up, -step);
+  }
+
+  state->cube_angle_rad += SIM_CUBE_SPIN * dt;
+  state->time += dt;
+}
+
+static void publish(const sim_state_t* state) {
+  pthread_mutex_lock(&snapshot_mutex);
+  current_snapshot = !current_snapshot;
+  snapshots[current_snapshot] = *state;
+  pthread_mutex_unlock(&snapshot_mutex);
+}
+
+static void sleep_until(double seconds) {
+  struct timespec ts;
+  ts.tv_sec = (time_t)seconds;
+  ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static void* sim_main(void* arg) {
+  const double dt = 1.0 / SIM_TICK_HZ;
+  sim_state_t state;
+  sim_input_t input;
+
+  profile_thread_name("sim");
+  pthread_mutex_lock(&snapshot_mutex);
+  state = snapshots[current_snapshot];
+  pthread_mutex_unlock(&snapshot_mutex);
+
+  while(__atomic_load_n(&sim_running, __ATOMIC_ACQUIRE)) {
+    sleep_until(state.time + dt);
+
+    pthread_mutex_lock(&input_mutex);
+    input = shared_input;
+    pthread_mutex_unlock(&input_mutex);
+
+    double now = now_seconds();
+    int ticks = 0;
+    while(state.time + dt <= now && ticks < 5) {
+      profile_zone_t zone = profile_begin("sim tick");
+      sim_tick(&state, &input, dt);
+      profile_end(&zone);
+      ticks++;
+    }
+    if(now - state.time > 5 * dt) {
+      //Drop the backlog (e.g. after a debugger stop) instead of fast-forwarding
+      state.time = now;
+    }
+    if(ticks > 0) {
+      publish(&state);
+    }
+  }
+  return NULL;
+}
+
+int sim_start(const GLfloat* camera_location, const GLfloat* camera_look) {
+  sim_state_t initial;
+  memset(&initial, 0, sizeof(initial));
+  initial.time = now_seconds();
+  memcpy(initial.camera_location, camera_location, sizeof(initial.camera_location));
+  snapshots[0] = initial;
+  snapshots[1] = initial;
+  current_snapshot = 0;
+
+  memset(&shared_input, 0, sizeof(shared_input));
+  memcpy(shared_input.camera_look, camera_look, sizeof(shared_input.camera_look));
+
+  sim_running = 1;
+  int err = pthread_create(&sim_thread, NULL, sim_main, NULL);
+  if(err != 0) {
+    printf("[ERROR] Unable to start simulation thread: %s\n", strerror(err));
+    sim_running = 0;
+    return -1;
+  }
+  return 0;
+}
+
+void sim_stop(void) {
+  if(!sim_running) {
+    return;
+  }
+  __atomic_store_n(&sim_running, 0, __ATOMIC_RELEASE);
+  pthread_join(sim_thread, NULL);
+}
+
+void sim_set_input(const sim_input_t* input) {
+  pthread_mutex_lock(&input_mutex);
+  shared_input = *input;
+  pthread_mutex_unlock(&input_mutex);
+}
+
+void sim_interpolate(sim_state_t* out) {
+  sim_state_t prev;
+  sim_state_t curr;
+  pthread_mutex_lock(&snapshot_mutex);
+  curr = snapshots[current_snapshot];
+  prev = snapshots[!current_snapshot];
+  pthread_mutex_unlock(&snapshot_mutex);
+
+  double span = curr.time - prev.time;
+  double alpha = 1.0;
+  if(span > 0.0) {
+    //Render one tick behind so there is always a snapshot to blend toward
+    alpha = (now_seconds() - curr.time) / span;
+    alpha = alpha < 0.0 ? 0.0 : (alpha > 1.0 ? 1.0 : alpha);
+  }
+
+  out->time = prev.time + span * alpha;
+  for(int i = 0; i < 3; i++) {
+    out->camera_location[i] = prev.camera_location[i] +
+      (curr.camera_location[i] - prev.camera_location[i]) * alpha;
+  }
+  out->cube_angle_rad = prev.cube_angle_rad +
+    (curr.cube_angle_rad - prev.cube_angle_rad) * alpha;
+}
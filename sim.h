@@ -0,0 +1,49 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <epoxy/gl.h>
+
+#define SIM_TICK_HZ 60
+//Units per second
+#define SIM_CAMERA_SPEED 3.0f
+//Radians per second about the X axis
+#define SIM_CUBE_SPIN (-50.0 * M_PI / 180.0)
+
+typedef struct {
+  int moving_forward;
+  int moving_backward;
+  int moving_left;
+  int moving_right;
+  int moving_up;
+  int moving_down;
+
+  GLfloat camera_look[3];
+} sim_input_t;
+
+typedef struct {
+  //Simulation time of this snapshot, in seconds
+  double time;
+  GLfloat camera_location[3];
+  double cube_angle_rad;
+} sim_state_t;
+
+/*
+ * Starts the simulation thread, which steps at SIM_TICK_HZ regardless
+ * of how fast frames are rendered.
+ */
+int sim_start(const GLfloat* camera_location, const GLfloat* camera_look);
+void sim_stop(void);
+
+/*
+ * Hands the latest input to the simulation; it takes effect on the
+ * next tick.
+ */
+void sim_set_input(const sim_input_t* input);
+
+/*
+ * Blends the two most recently published snapshots according to how far
+ * the current time is into the next tick.
+ */
+void sim_interpolate(sim_state_t* out);
+
+#endif
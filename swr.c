@@ -0,0 +1,568 @@
+#include "swr.h"
+#include "jobs.h"
+#include "arena.h"
+#include "profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+typedef struct {
+  GLfloat clip[4];
+  GLfloat attrs[SWR_ATTRS];
+} swr_clip_vertex_t;
+
+int swr_init(swr_context_t* swr, int width, int height) {
+  memset(swr, 0, sizeof(swr_context_t));
+  swr->width = width;
+  swr->height = height;
+  swr->tiles_x = (width + SWR_TILE_SIZE - 1) / SWR_TILE_SIZE;
+  swr->tiles_y = (height + SWR_TILE_SIZE - 1) / SWR_TILE_SIZE;
+  int tiles = swr->tiles_x * swr->tiles_y;
+  swr->color = malloc(sizeof(uint32_t) * width * height);
+  swr->depth = malloc(sizeof(GLfloat) * width * height);
+  swr->triangles = malloc(sizeof(swr_triangle_t) * SWR_MAX_TRIANGLES);
+  swr->bins = malloc(sizeof(uint32_t) * tiles * SWR_BIN_CAPACITY);
+  swr->bin_counts = calloc(tiles, sizeof(int));
+  if(!swr->color || !swr->depth || !swr->triangles || !swr->bins || !swr->bin_counts) {
+    printf("[ERROR] Unable to allocate %dx%d software render target\n", width, height);
+    swr_destroy(swr);
+    return -1;
+  }
+  return 0;
+}
+
+void swr_destroy(swr_context_t* swr) {
+  free(swr->color);
+  free(swr->depth);
+  free(swr->triangles);
+  free(swr->bins);
+  free(swr->bin_counts);
+  free(swr->mips[0]);
+  memset(swr, 0, sizeof(swr_context_t));
+}
+
+int swr_set_atlas(swr_context_t* swr, const texture_atlas_t* atlas) {
+  int levels = 1;
+  size_t total = 0;
+  for(int size = atlas->page_size; size > 0; size >>= 1) {
+    total += (size_t)size * size * 4 * atlas->num_layers;
+    if(size > 1) {
+      levels++;
+    }
+  }
+  if(levels > SWR_MAX_MIP_LEVELS) {
+    levels = SWR_MAX_MIP_LEVELS;
+  }
+  free(swr->mips[0]);
+  swr->mips[0] = malloc(total);
+  if(swr->mips[0] == NULL) {
+    printf("[ERROR] Unable to allocate software texture mip chain\n");
+    return -1;
+  }
+  swr->page_size = atlas->page_size;
+  swr->num_layers = atlas->num_layers;
+  swr->num_levels = levels;
+  memcpy(swr->mips[0], atlas->pixels, (size_t)atlas->page_size * atlas->page_size * 4 * atlas->num_layers);
+
+  //2x2 box filter, the same reduction glGenerateMipmap uses in practice
+  for(int level = 1; level < levels; level++) {
+    int src_size = atlas->page_size >> (level - 1);
+    int size = src_size >> 1;
+    unsigned char* src = swr->mips[level - 1];
+    unsigned char* dst = src + (size_t)src_size * src_size * 4 * atlas->num_layers;
+    swr->mips[level] = dst;
+    for(int layer = 0; layer < atlas->num_layers; layer++) {
+      unsigned char* src_layer = src + (size_t)layer * src_size * src_size * 4;
+      unsigned char* dst_layer = dst + (size_t)layer * size * size * 4;
+      for(int y = 0; y < size; y++) {
+	for(int x = 0; x < size; x++) {
+	  unsigned char* s00 = src_layer + ((size_t)(y * 2) * src_size + x * 2) * 4;
+	  unsigned char* s10 = s00 + src_size * 4;
+	  for(int ch = 0; ch < 4; ch++) {
+	    dst_layer[((size_t)y * size + x) * 4 + ch] = (s00[ch] + s00[ch + 4] + s10[ch] + s10[ch + 4] + 2) / 4;
+	  }
+	}
+      }
+    }
+  }
+  return 0;
+}
+
+void swr_set_lights(swr_context_t* swr, const light_clusters_t* clusters, const GLfloat* ambient) {
+  swr->clusters = clusters;
+  memcpy(swr->ambient, ambient, sizeof(swr->ambient));
+}
+
+void swr_clear(swr_context_t* swr, GLfloat r, GLfloat g, GLfloat b) {
+  uint32_t clear;
+  unsigned char* bytes = (unsigned char*)&clear;
+  bytes[0] = (unsigned char)(r * 255.0f + 0.5f);
+  bytes[1] = (unsigned char)(g * 255.0f + 0.5f);
+  bytes[2] = (unsigned char)(b * 255.0f + 0.5f);
+  bytes[3] = 255;
+  int pixels = swr->width * swr->height;
+  for(int i = 0; i < pixels; i++) {
+    swr->color[i] = clear;
+    swr->depth[i] = 1.0f;
+  }
+}
+
+static void transform4(const GLfloat* mat, const GLfloat* v, GLfloat* out) {
+  for(int row = 0; row < 4; row++) {
+    out[row] = mat[row * 4] * v[0] + mat[row * 4 + 1] * v[1] +
+      mat[row * 4 + 2] * v[2] + mat[row * 4 + 3] * v[3];
+  }
+}
+
+/*
+ * Same outputs as vert.glsl, including the normal being transformed as
+ * a point and renormalized per vertex.
+ */
+static void transform_vertex(const vertex_data_t* in,
+			     const GLfloat* model, const GLfloat* view, const GLfloat* projection,
+			     swr_clip_vertex_t* out) {
+  GLfloat position[4] = {in->x, in->y, in->z, 1.0f};
+  GLfloat normal[4] = {in->nx, in->ny, in->nz, 1.0f};
+  GLfloat world[4];
+  GLfloat eye[4];
+  GLfloat world_normal[4];
+  transform4(model, position, world);
+  transform4(view, world, eye);
+  transform4(projection, eye, out->clip);
+  transform4(model, normal, world_normal);
+  GLfloat len = sqrtf(world_normal[0] * world_normal[0] +
+		      world_normal[1] * world_normal[1] +
+		      world_normal[2] * world_normal[2]);
+  out->attrs[0] = in->s;
+  out->attrs[1] = in->t;
+  out->attrs[2] = world_normal[0] / len;
+  out->attrs[3] = world_normal[1] / len;
+  out->attrs[4] = world_normal[2] / len;
+  out->attrs[5] = world[0];
+  out->attrs[6] = world[1];
+  out->attrs[7] = world[2];
+}
+
+static void lerp_vertex(const swr_clip_vertex_t* a, const swr_clip_vertex_t* b, GLfloat t,
+			swr_clip_vertex_t* out) {
+  for(int i = 0; i < 4; i++) {
+    out->clip[i] = a->clip[i] + (b->clip[i] - a->clip[i]) * t;
+  }
+  for(int i = 0; i < SWR_ATTRS; i++) {
+    out->attrs[i] = a->attrs[i] + (b->attrs[i] - a->attrs[i]) * t;
+  }
+}
+
+/*
+ * Clips against the near plane (z >= -w).  The other planes are left to
+ * the scissor against the tile grid and the depth test.
+ */
+static int clip_near(const swr_clip_vertex_t* in, swr_clip_vertex_t* out) {
+  int count = 0;
+  for(int i = 0; i < 3; i++) {
+    const swr_clip_vertex_t* a = &in[i];
+    const swr_clip_vertex_t* b = &in[(i + 1) % 3];
+    GLfloat da = a->clip[2] + a->clip[3];
+    GLfloat db = b->clip[2] + b->clip[3];
+    if(da >= 0.0f) {
+      out[count++] = *a;
+    }
+    if((da >= 0.0f) != (db >= 0.0f)) {
+      lerp_vertex(a, b, da / (da - db), &out[count++]);
+    }
+  }
+  return count;
+}
+
+static void to_window(swr_context_t* swr, const swr_clip_vertex_t* in, swr_vertex_t* out) {
+  GLfloat inv_w = 1.0f / in->clip[3];
+  out->x = (in->clip[0] * inv_w + 1.0f) * 0.5f * swr->width;
+  out->y = (in->clip[1] * inv_w + 1.0f) * 0.5f * swr->height;
+  out->z = in->clip[2] * inv_w * 0.5f + 0.5f;
+  out->inv_w = inv_w;
+  for(int i = 0; i < SWR_ATTRS; i++) {
+    out->attrs[i] = in->attrs[i] * inv_w;
+  }
+}
+
+static void setup_triangle(swr_context_t* swr,
+			   const swr_clip_vertex_t* v0, const swr_clip_vertex_t* v1, const swr_clip_vertex_t* v2,
+			   const atlas_region_t* region, int enable_lighting) {
+  if(swr->num_triangles >= SWR_MAX_TRIANGLES) {
+    swr->dropped++;
+    return;
+  }
+  swr_triangle_t* tri = &swr->triangles[swr->num_triangles];
+  to_window(swr, v0, &tri->v[0]);
+  to_window(swr, v1, &tri->v[1]);
+  to_window(swr, v2, &tri->v[2]);
+
+  for(int i = 0; i < 3; i++) {
+    swr_vertex_t* vj = &tri->v[(i + 1) % 3];
+    swr_vertex_t* vk = &tri->v[(i + 2) % 3];
+    tri->a[i] = vj->y - vk->y;
+    tri->b[i] = vk->x - vj->x;
+    tri->c[i] = (vk->y - vj->y) * vj->x - (vk->x - vj->x) * vj->y;
+  }
+  GLfloat area = tri->a[0] * tri->v[0].x + tri->b[0] * tri->v[0].y + tri->c[0];
+  if(fabsf(area) < 1e-8f) {
+    return;
+  }
+  //Both windings are drawn, as GL does with culling disabled
+  GLfloat inv_area = 1.0f / area;
+  for(int i = 0; i < 3; i++) {
+    tri->a[i] *= inv_area;
+    tri->b[i] *= inv_area;
+    tri->c[i] *= inv_area;
+  }
+
+  GLfloat min_x = fminf(tri->v[0].x, fminf(tri->v[1].x, tri->v[2].x));
+  GLfloat max_x = fmaxf(tri->v[0].x, fmaxf(tri->v[1].x, tri->v[2].x));
+  GLfloat min_y = fminf(tri->v[0].y, fminf(tri->v[1].y, tri->v[2].y));
+  GLfloat max_y = fmaxf(tri->v[0].y, fmaxf(tri->v[1].y, tri->v[2].y));
+  tri->min_x = min_x < 0.0f ? 0 : (int)min_x;
+  tri->min_y = min_y < 0.0f ? 0 : (int)min_y;
+  tri->max_x = max_x >= swr->width ? swr->width - 1 : (int)max_x;
+  tri->max_y = max_y >= swr->height ? swr->height - 1 : (int)max_y;
+  if(tri->min_x > tri->max_x || tri->min_y > tri->max_y) {
+    return;
+  }
+  tri->region = region;
+  tri->enable_lighting = enable_lighting;
+
+  uint32_t index = swr->num_triangles++;
+  for(int ty = tri->min_y / SWR_TILE_SIZE; ty <= tri->max_y / SWR_TILE_SIZE; ty++) {
+    for(int tx = tri->min_x / SWR_TILE_SIZE; tx <= tri->max_x / SWR_TILE_SIZE; tx++) {
+      int tile = ty * swr->tiles_x + tx;
+      if(swr->bin_counts[tile] < SWR_BIN_CAPACITY) {
+	swr->bins[tile * SWR_BIN_CAPACITY + swr->bin_counts[tile]++] = index;
+      } else {
+	swr->dropped++;
+      }
+    }
+  }
+}
+
+void swr_draw(swr_context_t* swr,
+	      const vertex_data_t* vertices, const GLuint* indices, int index_count,
+	      const GLfloat* model, const GLfloat* view, const GLfloat* projection,
+	      const atlas_region_t* region, int enable_lighting) {
+  GLuint vertex_count = 0;
+  for(int i = 0; i < index_count; i++) {
+    if(indices[i] + 1 > vertex_count) {
+      vertex_count = indices[i] + 1;
+    }
+  }
+  //Only needed until the triangles are set up, so give it back afterwards
+  arena_t* arena = frame_arena();
+  size_t mark = arena_mark(arena);
+  swr_clip_vertex_t* transformed = arena_alloc(arena, sizeof(swr_clip_vertex_t) * vertex_count, 16);
+  for(GLuint i = 0; i < vertex_count; i++) {
+    transform_vertex(&vertices[i], model, view, projection, &transformed[i]);
+  }
+
+  for(int i = 0; i + 2 < index_count; i += 3) {
+    swr_clip_vertex_t in[3] = {
+      transformed[indices[i]],
+      transformed[indices[i + 1]],
+      transformed[indices[i + 2]]
+    };
+    swr_clip_vertex_t clipped[4];
+    int count = clip_near(in, clipped);
+    for(int k = 1; k + 1 < count; k++) {
+      setup_triangle(swr, &clipped[0], &clipped[k], &clipped[k + 1], region, enable_lighting);
+    }
+  }
+  arena_rewind(arena, mark);
+}
+
+static void fetch_bilinear(swr_context_t* swr, int level, int layer, GLfloat u, GLfloat v, GLfloat* out) {
+  int size = swr->page_size >> level;
+  const unsigned char* texels = swr->mips[level] + (size_t)layer * size * size * 4;
+  GLfloat x = u * size - 0.5f;
+  GLfloat y = v * size - 0.5f;
+  int x0 = (int)floorf(x);
+  int y0 = (int)floorf(y);
+  GLfloat fx = x - x0;
+  GLfloat fy = y - y0;
+  //GL_CLAMP_TO_EDGE
+  int x1 = x0 + 1 >= size ? size - 1 : x0 + 1;
+  int y1 = y0 + 1 >= size ? size - 1 : y0 + 1;
+  x0 = x0 < 0 ? 0 : (x0 >= size ? size - 1 : x0);
+  y0 = y0 < 0 ? 0 : (y0 >= size ? size - 1 : y0);
+  x1 = x1 < 0 ? 0 : x1;
+  y1 = y1 < 0 ? 0 : y1;
+  const unsigned char* t00 = texels + ((size_t)y0 * size + x0) * 4;
+  const unsigned char* t10 = texels + ((size_t)y0 * size + x1) * 4;
+  const unsigned char* t01 = texels + ((size_t)y1 * size + x0) * 4;
+  const unsigned char* t11 = texels + ((size_t)y1 * size + x1) * 4;
+  for(int ch = 0; ch < 4; ch++) {
+    GLfloat top = t00[ch] + (t10[ch] - t00[ch]) * fx;
+    GLfloat bottom = t01[ch] + (t11[ch] - t01[ch]) * fx;
+    out[ch] = (top + (bottom - top) * fy) / 255.0f;
+  }
+}
+
+/*
+ * Trilinear lookup inside an atlas region, matching the fract() wrap and
+ * textureGrad() call in frag.glsl.
+ */
+static void sample_atlas(swr_context_t* swr, const atlas_region_t* region,
+			 const GLfloat* tc, const GLfloat* dtc_dx, const GLfloat* dtc_dy,
+			 GLfloat* out) {
+  GLfloat u = region->rect[0] + (tc[0] - floorf(tc[0])) * region->rect[2];
+  GLfloat v = region->rect[1] + (tc[1] - floorf(tc[1])) * region->rect[3];
+  GLfloat texels_u = region->rect[2] * swr->page_size;
+  GLfloat texels_v = region->rect[3] * swr->page_size;
+  GLfloat du_dx = dtc_dx[0] * texels_u;
+  GLfloat dv_dx = dtc_dx[1] * texels_v;
+  GLfloat du_dy = dtc_dy[0] * texels_u;
+  GLfloat dv_dy = dtc_dy[1] * texels_v;
+  GLfloat rho = fmaxf(sqrtf(du_dx * du_dx + dv_dx * dv_dx), sqrtf(du_dy * du_dy + dv_dy * dv_dy));
+  GLfloat lod = rho > 1.0f ? log2f(rho) : 0.0f;
+  if(lod > swr->num_levels - 1) {
+    lod = swr->num_levels - 1;
+  }
+  int level = (int)lod;
+  GLfloat blend = lod - level;
+  int layer = (int)region->layer;
+  fetch_bilinear(swr, level, layer, u, v, out);
+  if(blend > 0.0f && level + 1 < swr->num_levels) {
+    GLfloat coarse[4];
+    fetch_bilinear(swr, level + 1, layer, u, v, coarse);
+    for(int ch = 0; ch < 4; ch++) {
+      out[ch] += (coarse[ch] - out[ch]) * blend;
+    }
+  }
+}
+
+static void light_pixel(swr_context_t* swr, int x, int y, GLfloat view_depth,
+			const GLfloat* normal, const GLfloat* frag_pos, GLfloat* diffuse) {
+  const light_clusters_t* clusters = swr->clusters;
+  if(clusters == NULL) {
+    return;
+  }
+  const light_list_t* lights = clusters->lights;
+  GLfloat log_ratio = logf(clusters->far_clip / clusters->near_clip);
+  GLfloat slice_f = logf(view_depth) * CLUSTER_Z / log_ratio -
+    CLUSTER_Z * logf(clusters->near_clip) / log_ratio;
+  int slice = slice_f > 0.0f ? (int)slice_f : 0;
+  int tx = (int)((x + 0.5f) / ((GLfloat)swr->width / CLUSTER_X));
+  int ty = (int)((y + 0.5f) / ((GLfloat)swr->height / CLUSTER_Y));
+  slice = slice >= CLUSTER_Z ? CLUSTER_Z - 1 : slice;
+  tx = tx >= CLUSTER_X ? CLUSTER_X - 1 : tx;
+  ty = ty >= CLUSTER_Y ? CLUSTER_Y - 1 : ty;
+  int cluster = tx + CLUSTER_X * (ty + CLUSTER_Y * slice);
+
+  GLuint offset = clusters->grid[cluster][0];
+  GLuint count = clusters->grid[cluster][1];
+  for(GLuint i = 0; i < count; i++) {
+    int light = clusters->indices[offset + i];
+    GLfloat to_light[3] = {
+      lights->x[light] - frag_pos[0],
+      lights->y[light] - frag_pos[1],
+      lights->z[light] - frag_pos[2]
+    };
+    GLfloat dist = sqrtf(to_light[0] * to_light[0] + to_light[1] * to_light[1] + to_light[2] * to_light[2]);
+    GLfloat falloff = 1.0f - dist / lights->radius[light];
+    if(falloff <= 0.0f) {
+      continue;
+    }
+    falloff = falloff > 1.0f ? 1.0f : falloff;
+    GLfloat diff = (normal[0] * to_light[0] + normal[1] * to_light[1] + normal[2] * to_light[2]) / dist;
+    if(diff <= 0.0f) {
+      continue;
+    }
+    for(int ch = 0; ch < 3; ch++) {
+      diffuse[ch] += diff * falloff * falloff * lights->color[light][ch];
+    }
+  }
+}
+
+static void shade_pixel(swr_context_t* swr, const swr_triangle_t* tri, int x, int y,
+			GLfloat l0, GLfloat l1, GLfloat l2) {
+  const swr_vertex_t* v = tri->v;
+  GLfloat w = l0 * v[0].inv_w + l1 * v[1].inv_w + l2 * v[2].inv_w;
+  GLfloat inv = 1.0f / w;
+  GLfloat attrs[SWR_ATTRS];
+  for(int i = 0; i < SWR_ATTRS; i++) {
+    attrs[i] = (l0 * v[0].attrs[i] + l1 * v[1].attrs[i] + l2 * v[2].attrs[i]) * inv;
+  }
+
+  //Screen-space derivatives of s and t, for mip selection
+  GLfloat dw_dx = tri->a[0] * v[0].inv_w + tri->a[1] * v[1].inv_w + tri->a[2] * v[2].inv_w;
+  GLfloat dw_dy = tri->b[0] * v[0].inv_w + tri->b[1] * v[1].inv_w + tri->b[2] * v[2].inv_w;
+  GLfloat dtc_dx[2];
+  GLfloat dtc_dy[2];
+  for(int i = 0; i < 2; i++) {
+    GLfloat da_dx = tri->a[0] * v[0].attrs[i] + tri->a[1] * v[1].attrs[i] + tri->a[2] * v[2].attrs[i];
+    GLfloat da_dy = tri->b[0] * v[0].attrs[i] + tri->b[1] * v[1].attrs[i] + tri->b[2] * v[2].attrs[i];
+    dtc_dx[i] = (da_dx - attrs[i] * dw_dx) * inv;
+    dtc_dy[i] = (da_dy - attrs[i] * dw_dy) * inv;
+  }
+  GLfloat tc[2] = {attrs[0], 1.0f - attrs[1]};
+
+  GLfloat color[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+  if(swr->mips[0] && tri->region) {
+    sample_atlas(swr, tri->region, tc, dtc_dx, dtc_dy, color);
+  }
+  if(tri->enable_lighting) {
+    GLfloat light[3];
+    memcpy(light, swr->ambient, sizeof(light));
+    //w is the eye-space distance along the view axis for this projection
+    light_pixel(swr, x, y, inv, attrs + 2, attrs + 5, light);
+    for(int ch = 0; ch < 3; ch++) {
+      color[ch] *= light[ch];
+    }
+  }
+
+  unsigned char* out = (unsigned char*)&swr->color[y * swr->width + x];
+  for(int ch = 0; ch < 4; ch++) {
+    GLfloat c = color[ch] > 1.0f ? 1.0f : (color[ch] < 0.0f ? 0.0f : color[ch]);
+    out[ch] = (unsigned char)(c * 255.0f + 0.5f);
+  }
+}
+
+static void raster_triangle(swr_context_t* swr, const swr_triangle_t* tri,
+			    int x0, int y0, int x1, int y1) {
+  if(tri->min_x > x0) {
+    x0 = tri->min_x;
+  }
+  if(tri->min_y > y0) {
+    y0 = tri->min_y;
+  }
+  if(tri->max_x < x1) {
+    x1 = tri->max_x;
+  }
+  if(tri->max_y < y1) {
+    y1 = tri->max_y;
+  }
+  const swr_vertex_t* v = tri->v;
+#ifdef __SSE__
+  __m128 lane_offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+  __m128 a0 = _mm_set1_ps(tri->a[0]);
+  __m128 a1 = _mm_set1_ps(tri->a[1]);
+  __m128 a2 = _mm_set1_ps(tri->a[2]);
+  __m128 z0 = _mm_set1_ps(v[0].z);
+  __m128 z1 = _mm_set1_ps(v[1].z);
+  __m128 z2 = _mm_set1_ps(v[2].z);
+  __m128 zero = _mm_setzero_ps();
+#endif
+  for(int y = y0; y <= y1; y++) {
+    GLfloat py = y + 0.5f;
+    GLfloat row0 = tri->b[0] * py + tri->c[0];
+    GLfloat row1 = tri->b[1] * py + tri->c[1];
+    GLfloat row2 = tri->b[2] * py + tri->c[2];
+    GLfloat* depth_row = swr->depth + y * swr->width;
+    int x = x0;
+#ifdef __SSE__
+    for(; x <= x1; x += 4) {
+      __m128 px = _mm_add_ps(_mm_set1_ps((GLfloat)x), lane_offsets);
+      __m128 l0 = _mm_add_ps(_mm_mul_ps(a0, px), _mm_set1_ps(row0));
+      __m128 l1 = _mm_add_ps(_mm_mul_ps(a1, px), _mm_set1_ps(row1));
+      __m128 l2 = _mm_add_ps(_mm_mul_ps(a2, px), _mm_set1_ps(row2));
+      __m128 inside = _mm_and_ps(_mm_cmpge_ps(l0, zero),
+				 _mm_and_ps(_mm_cmpge_ps(l1, zero), _mm_cmpge_ps(l2, zero)));
+      int mask = _mm_movemask_ps(inside);
+      if(x1 - x < 3) {
+	mask &= (1 << (x1 - x + 1)) - 1;
+      }
+      if(mask == 0) {
+	continue;
+      }
+      __m128 z = _mm_add_ps(_mm_mul_ps(l0, z0), _mm_add_ps(_mm_mul_ps(l1, z1), _mm_mul_ps(l2, z2)));
+      __m128 depth;
+      if(x1 - x < 3) {
+	//Lanes past x1 belong to the next tile, which another job may be writing
+	GLfloat tail[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+	memcpy(tail, depth_row + x, (x1 - x + 1) * sizeof(GLfloat));
+	depth = _mm_loadu_ps(tail);
+      } else {
+	depth = _mm_loadu_ps(depth_row + x);
+      }
+      mask &= _mm_movemask_ps(_mm_cmplt_ps(z, depth));
+      if(mask == 0) {
+	continue;
+      }
+      GLfloat lane_l0[4];
+      GLfloat lane_l1[4];
+      GLfloat lane_l2[4];
+      GLfloat lane_z[4];
+      _mm_storeu_ps(lane_l0, l0);
+      _mm_storeu_ps(lane_l1, l1);
+      _mm_storeu_ps(lane_l2, l2);
+      _mm_storeu_ps(lane_z, z);
+      while(mask) {
+	int lane = __builtin_ctz(mask);
+	mask &= mask - 1;
+	depth_row[x + lane] = lane_z[lane];
+	shade_pixel(swr, tri, x + lane, y, lane_l0[lane], lane_l1[lane], lane_l2[lane]);
+      }
+    }
+#else
+    for(; x <= x1; x++) {
+      GLfloat px = x + 0.5f;
+      GLfloat l0 = tri->a[0] * px + row0;
+      GLfloat l1 = tri->a[1] * px + row1;
+      GLfloat l2 = tri->a[2] * px + row2;
+      if(l0 < 0.0f || l1 < 0.0f || l2 < 0.0f) {
+	continue;
+      }
+      GLfloat z = l0 * v[0].z + l1 * v[1].z + l2 * v[2].z;
+      if(z >= depth_row[x]) {
+	continue;
+      }
+      depth_row[x] = z;
+      shade_pixel(swr, tri, x, y, l0, l1, l2);
+    }
+#endif
+  }
+}
+
+static void raster_tiles(void* data, int start, int end) {
+  profile_zone_t zone = profile_begin("swr tiles");
+  swr_context_t* swr = data;
+  for(int tile = start; tile < end; tile++) {
+    int x0 = (tile % swr->tiles_x) * SWR_TILE_SIZE;
+    int y0 = (tile / swr->tiles_x) * SWR_TILE_SIZE;
+    int x1 = x0 + SWR_TILE_SIZE - 1 < swr->width ? x0 + SWR_TILE_SIZE - 1 : swr->width - 1;
+    int y1 = y0 + SWR_TILE_SIZE - 1 < swr->height ? y0 + SWR_TILE_SIZE - 1 : swr->height - 1;
+    uint32_t* bin = swr->bins + tile * SWR_BIN_CAPACITY;
+    //Bins keep submission order, so depth ties resolve as they do on the GPU
+    for(int i = 0; i < swr->bin_counts[tile]; i++) {
+      raster_triangle(swr, &swr->triangles[bin[i]], x0, y0, x1, y1);
+    }
+  }
+  profile_end(&zone);
+}
+
+void swr_flush(swr_context_t* swr) {
+  int tiles = swr->tiles_x * swr->tiles_y;
+  job_counter_t done = {0};
+  jobs_parallel_for(raster_tiles, swr, tiles, 1, &done);
+  jobs_wait(&done);
+
+  //Report when dropping starts and stops rather than every frame
+  if(swr->dropped) {
+    if(swr->dropped_frames == 0) {
+      printf("[WARNING] Software renderer dropped %u triangles: triangle or bin storage full\n",
+	     swr->dropped);
+    }
+    swr->dropped_frames++;
+    swr->dropped_total += swr->dropped;
+    swr->dropped = 0;
+  } else if(swr->dropped_frames) {
+    printf("[INFO] Software renderer triangles fit again after %u frames; %u triangles dropped\n",
+	   swr->dropped_frames, swr->dropped_total);
+    swr->dropped_frames = 0;
+    swr->dropped_total = 0;
+  }
+  swr->num_triangles = 0;
+  memset(swr->bin_counts, 0, sizeof(int) * tiles);
+}
@@ -0,0 +1,96 @@
+#ifndef SWR_H
+#define SWR_H
+
+#include <epoxy/gl.h>
+#include <stdint.h>
+
+#include "gl_ops.h"
+#include "atlas.h"
+#include "lights.h"
+
+#define SWR_TILE_SIZE 64
+#define SWR_MAX_TRIANGLES 65536
+#define SWR_BIN_CAPACITY 8192
+//s, t, normal xyz, world position xyz
+#define SWR_ATTRS 8
+#define SWR_MAX_MIP_LEVELS 16
+
+typedef struct {
+  //Window position in pixels, window depth and 1/w
+  GLfloat x;
+  GLfloat y;
+  GLfloat z;
+  GLfloat inv_w;
+  //Attributes premultiplied by 1/w for perspective-correct interpolation
+  GLfloat attrs[SWR_ATTRS];
+} swr_vertex_t;
+
+typedef struct {
+  swr_vertex_t v[3];
+  //Edge functions; E_i(x, y) = a[i] * x + b[i] * y + c[i], scaled so the
+  //three sum to 1 and act as barycentrics
+  GLfloat a[3];
+  GLfloat b[3];
+  GLfloat c[3];
+  int min_x;
+  int min_y;
+  int max_x;
+  int max_y;
+  const atlas_region_t* region;
+  int enable_lighting;
+} swr_triangle_t;
+
+/*
+ * CPU renderer mirroring vert.glsl/frag.glsl.  Draws are transformed and
+ * binned into screen tiles on the calling thread; swr_flush() then
+ * rasterizes and shades each tile as a job.  The color buffer is RGBA8
+ * with row 0 at the bottom, the same layout glReadPixels returns.
+ */
+typedef struct {
+  int width;
+  int height;
+  int tiles_x;
+  int tiles_y;
+  uint32_t* color;
+  GLfloat* depth;
+
+  swr_triangle_t* triangles;
+  int num_triangles;
+  uint32_t* bins;
+  int* bin_counts;
+  //Triangles dropped from tiles this frame, when triangles or bins are full
+  unsigned int dropped;
+  //Length of the current run of frames that dropped triangles, and its drops
+  unsigned int dropped_frames;
+  unsigned int dropped_total;
+
+  //Box-filtered copy of the texture atlas, one pointer per mip level
+  int page_size;
+  int num_layers;
+  int num_levels;
+  unsigned char* mips[SWR_MAX_MIP_LEVELS];
+
+  const light_clusters_t* clusters;
+  GLfloat ambient[3];
+} swr_context_t;
+
+int swr_init(swr_context_t* swr, int width, int height);
+void swr_destroy(swr_context_t* swr);
+/*
+ * Takes a copy of the atlas pixels and builds their mip chain.
+ */
+int swr_set_atlas(swr_context_t* swr, const texture_atlas_t* atlas);
+/*
+ * Lighting inputs; the clusters must have been built for a viewport of
+ * the same size as this context.
+ */
+void swr_set_lights(swr_context_t* swr, const light_clusters_t* clusters, const GLfloat* ambient);
+
+void swr_clear(swr_context_t* swr, GLfloat r, GLfloat g, GLfloat b);
+void swr_draw(swr_context_t* swr,
+	      const vertex_data_t* vertices, const GLuint* indices, int index_count,
+	      const GLfloat* model, const GLfloat* view, const GLfloat* projection,
+	      const atlas_region_t* region, int enable_lighting);
+void swr_flush(swr_context_t* swr);
+
+#endif
@@ -0,0 +1,545 @@
+#include "terrain.h"
+#include "matrix_ops.h"
+#include "profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <math.h>
+#include <assert.h>
+
+#define TERRAIN_MAP_EMPTY -1
+//The chunk could not be read; it is never requested again
+#define TERRAIN_MAP_FAILED -2
+
+#define CHUNK_BYTES (TERRAIN_CHUNK_SAMPLES * TERRAIN_CHUNK_SAMPLES * sizeof(uint16_t))
+#define GRID_INDEX(i, j) ((j) * (TERRAIN_CHUNK_CELLS + 1) + (i))
+
+static void* loader_main(void* arg);
+//Every access is atomic: the loader thread publishes LOADED while the GL
+//thread reads the state
+//The loader thread publishes LOADED while the GL thread reads the state
+static int chunk_state(const terrain_chunk_t* chunk) {
+  return __atomic_load_n(&chunk->state, __ATOMIC_ACQUIRE);
+}
+
+static void set_chunk_state(terrain_chunk_t* chunk, int state) {
+  __atomic_store_n(&chunk->state, state, __ATOMIC_RELEASE);
+}
+
+/*
+ * Skirt vertices follow the grid, one row per edge: z = 0, z = max,
+ * x = 0, x = max.
+ */
+static GLuint skirt_index(int edge, int k) {
+  return TERRAIN_GRID_VERTICES + edge * (TERRAIN_CHUNK_CELLS + 1) + k;
+}
+
+static GLuint edge_index(int edge, int k) {
+  switch(edge) {
+  case 0:
+    return GRID_INDEX(k, 0);
+  case 1:
+    return GRID_INDEX(k, TERRAIN_CHUNK_CELLS);
+  case 2:
+    return GRID_INDEX(0, k);
+  default:
+    return GRID_INDEX(TERRAIN_CHUNK_CELLS, k);
+  }
+}
+
+static GLuint* emit_quad(GLuint* out, GLuint a, GLuint b, GLuint c, GLuint d) {
+  out[0] = a;
+  out[1] = b;
+  out[2] = d;
+  out[3] = b;
+  out[4] = c;
+  out[5] = d;
+  return out + 6;
+}
+
+static void build_lod_indices(terrain_t* terrain) {
+  GLsizei total = 0;
+  for(int level = 0; level < TERRAIN_LOD_LEVELS; level++) {
+    int quads = TERRAIN_CHUNK_CELLS >> level;
+    terrain->lod_offset[level] = total;
+    terrain->lod_count[level] = (quads * quads + 4 * quads) * 6;
+    total += terrain->lod_count[level];
+  }
+  terrain->indices = malloc(sizeof(GLuint) * total);
+
+  for(int level = 0; level < TERRAIN_LOD_LEVELS; level++) {
+    int step = 1 << level;
+    GLuint* out = terrain->indices + terrain->lod_offset[level];
+    for(int j = 0; j < TERRAIN_CHUNK_CELLS; j += step) {
+      for(int i = 0; i < TERRAIN_CHUNK_CELLS; i += step) {
+	out = emit_quad(out,
+			GRID_INDEX(i, j), GRID_INDEX(i + step, j),
+			GRID_INDEX(i + step, j + step), GRID_INDEX(i, j + step));
+      }
+    }
+    //Skirts hang down from each edge to hide cracks between LODs
+    for(int edge = 0; edge < 4; edge++) {
+      for(int k = 0; k < TERRAIN_CHUNK_CELLS; k += step) {
+	out = emit_quad(out,
+			edge_index(edge, k), edge_index(edge, k + step),
+			skirt_index(edge, k + step), skirt_index(edge, k));
+      }
+    }
+    assert(out == terrain->indices + terrain->lod_offset[level] + terrain->lod_count[level]);
+  }
+
+  if(terrain->use_gl) {
+    glGenBuffers(1, &terrain->ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, terrain->ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * total, terrain->indices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  }
+}
+
+int terrain_open(terrain_t* terrain, const char* filename, int use_gl) {
+  memset(terrain, 0, sizeof(terrain_t));
+  terrain->use_gl = use_gl;
+  terrain->fd = open(filename, O_RDONLY);
+  if(terrain->fd < 0) {
+    printf("[ERROR] Unable to open terrain %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+  terrain_header_t* header = &terrain->header;
+  if(pread(terrain->fd, header, sizeof(terrain_header_t), 0) != sizeof(terrain_header_t) ||
+     memcmp(header->magic, TERRAIN_MAGIC, 4) != 0) {
+    printf("[ERROR] %s is not a terrain file\n", filename);
+    close(terrain->fd);
+    return -1;
+  }
+  if(header->version != TERRAIN_VERSION || header->chunk_cells != TERRAIN_CHUNK_CELLS ||
+     header->chunks_x == 0 || header->chunks_z == 0 ||
+     header->chunks_x > INT16_MAX || header->chunks_z > INT16_MAX) {
+    printf("[ERROR] Terrain %s has version %u and %u-cell chunks; expected version %d and %d-cell chunks\n",
+	   filename, header->version, header->chunk_cells, TERRAIN_VERSION, TERRAIN_CHUNK_CELLS);
+    close(terrain->fd);
+    return -1;
+  }
+
+  int map_size = header->chunks_x * header->chunks_z;
+  terrain->chunk_map = malloc(sizeof(int16_t) * map_size);
+  for(int i = 0; i < map_size; i++) {
+    terrain->chunk_map[i] = TERRAIN_MAP_EMPTY;
+  }
+  //The map is centered on the origin
+  GLfloat chunk_size = TERRAIN_CHUNK_CELLS * header->cell_size;
+  terrain->origin_x = -0.5f * header->chunks_x * chunk_size;
+  terrain->origin_z = -0.5f * header->chunks_z * chunk_size;
+
+  if(pool_init(&terrain->mesh_pool, sizeof(vertex_data_t) * TERRAIN_CHUNK_VERTICES,
+	       TERRAIN_MAX_CHUNKS) < 0) {
+    free(terrain->chunk_map);
+    close(terrain->fd);
+    return -1;
+  }
+  for(int i = 0; i < TERRAIN_MAX_CHUNKS; i++) {
+    terrain->chunks[i].terrain = terrain;
+    set_chunk_state(&terrain->chunks[i], TERRAIN_CHUNK_FREE);
+  }
+  build_lod_indices(terrain);
+
+  pthread_mutex_init(&terrain->load_mutex, NULL);
+  pthread_cond_init(&terrain->load_cond, NULL);
+  terrain->loader_running = 1;
+  int err = pthread_create(&terrain->loader, NULL, loader_main, terrain);
+  if(err != 0) {
+    printf("[ERROR] Unable to start terrain loader thread: %s\n", strerror(err));
+    pthread_mutex_destroy(&terrain->load_mutex);
+    pthread_cond_destroy(&terrain->load_cond);
+    if(terrain->use_gl) {
+      glDeleteBuffers(1, &terrain->ebo);
+    }
+    free(terrain->indices);
+    pool_destroy(&terrain->mesh_pool);
+    free(terrain->chunk_map);
+    close(terrain->fd);
+    return -1;
+  }
+
+  size_t budget = (size_t)TERRAIN_MAX_CHUNKS * sizeof(vertex_data_t) * TERRAIN_CHUNK_VERTICES;
+  printf("[INFO] Terrain %s: %ux%u chunks of %d cells; budget %d chunks, %.1f MB each on CPU and GPU\n",
+	 filename, header->chunks_x, header->chunks_z, TERRAIN_CHUNK_CELLS,
+	 TERRAIN_MAX_CHUNKS, budget / (1024.0 * 1024.0));
+  return 0;
+}
+
+void terrain_close(terrain_t* terrain) {
+  pthread_mutex_lock(&terrain->load_mutex);
+  terrain->loader_running = 0;
+  pthread_cond_signal(&terrain->load_cond);
+  pthread_mutex_unlock(&terrain->load_mutex);
+  pthread_join(terrain->loader, NULL);
+  pthread_mutex_destroy(&terrain->load_mutex);
+  pthread_cond_destroy(&terrain->load_cond);
+  for(int i = 0; i < TERRAIN_MAX_CHUNKS; i++) {
+    terrain_chunk_t* chunk = &terrain->chunks[i];
+    if(chunk->vao != 0) {
+      glDeleteVertexArrays(1, &chunk->vao);
+      glDeleteBuffers(1, &chunk->vbo);
+    }
+  }
+  if(terrain->use_gl) {
+    glDeleteBuffers(1, &terrain->ebo);
+  }
+  free(terrain->indices);
+  pool_destroy(&terrain->mesh_pool);
+  free(terrain->chunk_map);
+  close(terrain->fd);
+  printf("[INFO] Terrain streamed %u chunks, evicted %u, peak %d resident of %d\n",
+	 terrain->chunks_loaded, terrain->chunks_evicted, terrain->peak_resident, TERRAIN_MAX_CHUNKS);
+}
+
+static GLfloat sample_height(const terrain_header_t* header, const uint16_t* samples, int i, int j) {
+  //Grid coordinates start at -1 because of the apron
+  uint16_t raw = samples[(j + 1) * TERRAIN_CHUNK_SAMPLES + (i + 1)];
+  return header->min_height + (header->max_height - header->min_height) * (raw / 65535.0f);
+}
+
+/*
+ * Largest difference between the full-resolution heights and the
+ * bilinear surface through every step-th sample.
+ */
+static GLfloat lod_error(const GLfloat* heights, int step) {
+  GLfloat error = 0.0f;
+  for(int j = 0; j <= TERRAIN_CHUNK_CELLS; j++) {
+    int j0 = j / step * step;
+    int j1 = j0 < TERRAIN_CHUNK_CELLS ? j0 + step : j0;
+    GLfloat fj = (GLfloat)(j - j0) / step;
+    for(int i = 0; i <= TERRAIN_CHUNK_CELLS; i++) {
+      int i0 = i / step * step;
+      int i1 = i0 < TERRAIN_CHUNK_CELLS ? i0 + step : i0;
+      GLfloat fi = (GLfloat)(i - i0) / step;
+      GLfloat near_row = heights[GRID_INDEX(i0, j0)] * (1.0f - fi) + heights[GRID_INDEX(i1, j0)] * fi;
+      GLfloat far_row = heights[GRID_INDEX(i0, j1)] * (1.0f - fi) + heights[GRID_INDEX(i1, j1)] * fi;
+      GLfloat approx = near_row * (1.0f - fj) + far_row * fj;
+      GLfloat diff = fabsf(heights[GRID_INDEX(i, j)] - approx);
+      error = diff > error ? diff : error;
+    }
+  }
+  return error;
+}
+
+/*
+ * Reads one chunk from disk and builds its mesh.  Only touches the chunk
+ * it is given until it publishes the LOADED state.
+ */
+static void load_chunk(terrain_chunk_t* chunk) {
+  profile_zone_t zone = profile_begin("terrain load");
+  const terrain_t* terrain = chunk->terrain;
+  const terrain_header_t* header = &terrain->header;
+
+  uint16_t samples[TERRAIN_CHUNK_SAMPLES * TERRAIN_CHUNK_SAMPLES];
+  off_t offset = sizeof(terrain_header_t) +
+    ((off_t)chunk->chunk_z * header->chunks_x + chunk->chunk_x) * CHUNK_BYTES;
+  chunk->load_failed = pread(terrain->fd, samples, CHUNK_BYTES, offset) != CHUNK_BYTES;
+  if(chunk->load_failed) {
+    set_chunk_state(chunk, TERRAIN_CHUNK_LOADED);
+    profile_end(&zone);
+    return;
+  }
+
+  GLfloat cell = header->cell_size;
+  GLfloat corner_x = terrain->origin_x + chunk->chunk_x * TERRAIN_CHUNK_CELLS * cell;
+  GLfloat corner_z = terrain->origin_z + chunk->chunk_z * TERRAIN_CHUNK_CELLS * cell;
+  GLfloat heights[TERRAIN_GRID_VERTICES];
+  GLfloat min_height = header->max_height;
+  GLfloat max_height = header->min_height;
+  vertex_data_t* vertices = chunk->vertices;
+  for(int j = 0; j <= TERRAIN_CHUNK_CELLS; j++) {
+    for(int i = 0; i <= TERRAIN_CHUNK_CELLS; i++) {
+      GLfloat height = sample_height(header, samples, i, j);
+      heights[GRID_INDEX(i, j)] = height;
+      min_height = height < min_height ? height : min_height;
+      max_height = height > max_height ? height : max_height;
+
+      vertex_data_t* vertex = &vertices[GRID_INDEX(i, j)];
+      vertex->x = corner_x + i * cell;
+      vertex->y = height;
+      vertex->z = corner_z + j * cell;
+      //One texture repeat per world unit, like the old ground quad
+      vertex->s = vertex->x;
+      vertex->t = vertex->z;
+      GLfloat normal[3] = {
+	sample_height(header, samples, i - 1, j) - sample_height(header, samples, i + 1, j),
+	2.0f * cell,
+	sample_height(header, samples, i, j - 1) - sample_height(header, samples, i, j + 1)
+      };
+      GLfloat length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+      vertex->nx = normal[0] / length;
+      vertex->ny = normal[1] / length;
+      vertex->nz = normal[2] / length;
+    }
+  }
+
+  GLfloat error = 0.0f;
+  for(int level = 0; level < TERRAIN_LOD_LEVELS; level++) {
+    GLfloat level_error = level == 0 ? 0.0f : lod_error(heights, 1 << level);
+    error = level_error > error ? level_error : error;
+    chunk->lod_error[level] = error;
+  }
+
+  //Deep enough to cover the gap to a neighbour at the coarsest LOD
+  GLfloat skirt_depth = error + cell;
+  for(int edge = 0; edge < 4; edge++) {
+    for(int k = 0; k <= TERRAIN_CHUNK_CELLS; k++) {
+      vertex_data_t* skirt = &vertices[skirt_index(edge, k)];
+      *skirt = vertices[edge_index(edge, k)];
+      skirt->y -= skirt_depth;
+    }
+  }
+
+  chunk->bounds_min[0] = corner_x;
+  chunk->bounds_min[1] = min_height - skirt_depth;
+  chunk->bounds_min[2] = corner_z;
+  chunk->bounds_max[0] = corner_x + TERRAIN_CHUNK_CELLS * cell;
+  chunk->bounds_max[1] = max_height;
+  chunk->bounds_max[2] = corner_z + TERRAIN_CHUNK_CELLS * cell;
+  set_chunk_state(chunk, TERRAIN_CHUNK_LOADED);
+  profile_end(&zone);
+}
+
+static void* loader_main(void* arg) {
+  terrain_t* terrain = arg;
+  profile_thread_name("terrain loader");
+  pthread_mutex_lock(&terrain->load_mutex);
+  while(1) {
+    while(terrain->loader_running && terrain->load_count == 0) {
+      pthread_cond_wait(&terrain->load_cond, &terrain->load_mutex);
+    }
+    //Queued loads are dropped on shutdown; their chunks are freed anyway
+    if(!terrain->loader_running) {
+      break;
+    }
+    terrain_chunk_t* chunk = terrain->load_queue[terrain->load_head];
+    terrain->load_head = (terrain->load_head + 1) % TERRAIN_MAX_LOADS_IN_FLIGHT;
+    terrain->load_count--;
+    pthread_mutex_unlock(&terrain->load_mutex);
+    load_chunk(chunk);
+    pthread_mutex_lock(&terrain->load_mutex);
+  }
+  pthread_mutex_unlock(&terrain->load_mutex);
+  return NULL;
+}
+
+static void upload_chunk(terrain_t* terrain, terrain_chunk_t* chunk) {
+  if(chunk->vao == 0) {
+    glGenVertexArrays(1, &chunk->vao);
+    glGenBuffers(1, &chunk->vbo);
+    glBindVertexArray(chunk->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, chunk->vbo);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_data_t), (GLvoid*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(vertex_data_t), (GLvoid*)(3 *  sizeof(GLfloat)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_data_t), (GLvoid*)(5 *  sizeof(GLfloat)));
+    glEnableVertexAttribArray(2);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, terrain->ebo);
+    glBindVertexArray(0);
+  }
+  //Respecifying the store lets the driver orphan a buffer still in flight
+  glBindBuffer(GL_ARRAY_BUFFER, chunk->vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_data_t) * TERRAIN_CHUNK_VERTICES,
+	       chunk->vertices, GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void evict_chunk(terrain_t* terrain, terrain_chunk_t* chunk) {
+  terrain->chunk_map[chunk->chunk_z * terrain->header.chunks_x + chunk->chunk_x] = TERRAIN_MAP_EMPTY;
+  pool_free(&terrain->mesh_pool, chunk->vertices);
+  chunk->vertices = NULL;
+  set_chunk_state(chunk, TERRAIN_CHUNK_FREE);
+}
+
+static int chunk_distance(const terrain_chunk_t* chunk, int center_x, int center_z) {
+  int dx = abs(chunk->chunk_x - center_x);
+  int dz = abs(chunk->chunk_z - center_z);
+  return dx > dz ? dx : dz;
+}
+
+/*
+ * Finds a slot for a chunk at the given ring distance, evicting the
+ * farthest chunk if the budget is full and it is farther away.
+ */
+static terrain_chunk_t* claim_slot(terrain_t* terrain, int center_x, int center_z, int distance) {
+  terrain_chunk_t* farthest = NULL;
+  int farthest_distance = distance;
+  for(int i = 0; i < TERRAIN_MAX_CHUNKS; i++) {
+    terrain_chunk_t* chunk = &terrain->chunks[i];
+    if(chunk_state(chunk) == TERRAIN_CHUNK_FREE) {
+      return chunk;
+    }
+    if(chunk_state(chunk) == TERRAIN_CHUNK_RESIDENT) {
+      int chunk_dist = chunk_distance(chunk, center_x, center_z);
+      if(chunk_dist > farthest_distance) {
+	farthest = chunk;
+	farthest_distance = chunk_dist;
+      }
+    }
+  }
+  if(farthest != NULL) {
+    evict_chunk(terrain, farthest);
+    terrain->chunks_evicted++;
+  }
+  return farthest;
+}
+
+static int request_chunk(terrain_t* terrain, int chunk_x, int chunk_z,
+			 int center_x, int center_z, int distance) {
+  int16_t* map_entry = &terrain->chunk_map[chunk_z * terrain->header.chunks_x + chunk_x];
+  if(*map_entry != TERRAIN_MAP_EMPTY) {
+    return 0;
+  }
+  terrain_chunk_t* chunk = claim_slot(terrain, center_x, center_z, distance);
+  if(chunk == NULL) {
+    return -1;
+  }
+  chunk->chunk_x = chunk_x;
+  chunk->chunk_z = chunk_z;
+  chunk->vertices = pool_alloc(&terrain->mesh_pool);
+  set_chunk_state(chunk, TERRAIN_CHUNK_LOADING);
+  *map_entry = chunk - terrain->chunks;
+  terrain->loads_in_flight++;
+  //In-flight loads are capped, so the queue never fills up
+  pthread_mutex_lock(&terrain->load_mutex);
+  int tail = (terrain->load_head + terrain->load_count) % TERRAIN_MAX_LOADS_IN_FLIGHT;
+  terrain->load_queue[tail] = chunk;
+  terrain->load_count++;
+  pthread_cond_signal(&terrain->load_cond);
+  pthread_mutex_unlock(&terrain->load_mutex);
+  return 0;
+}
+
+void terrain_update(terrain_t* terrain, const GLfloat* camera_location) {
+  profile_zone_t zone = profile_begin("terrain update");
+  int uploads = 0;
+  int resident = 0;
+  for(int i = 0; i < TERRAIN_MAX_CHUNKS; i++) {
+    terrain_chunk_t* chunk = &terrain->chunks[i];
+    if(chunk_state(chunk) == TERRAIN_CHUNK_LOADED &&
+       uploads < TERRAIN_UPLOADS_PER_FRAME) {
+      terrain->loads_in_flight--;
+      if(chunk->load_failed) {
+	printf("[WARNING] Unable to read terrain chunk %d,%d\n", chunk->chunk_x, chunk->chunk_z);
+	evict_chunk(terrain, chunk);
+	terrain->chunk_map[chunk->chunk_z * terrain->header.chunks_x + chunk->chunk_x] = TERRAIN_MAP_FAILED;
+	continue;
+      }
+      if(terrain->use_gl) {
+	upload_chunk(terrain, chunk);
+      }
+      set_chunk_state(chunk, TERRAIN_CHUNK_RESIDENT);
+      terrain->chunks_loaded++;
+      uploads++;
+    }
+    if(chunk_state(chunk) == TERRAIN_CHUNK_RESIDENT) {
+      resident++;
+    }
+  }
+  terrain->peak_resident = resident > terrain->peak_resident ? resident : terrain->peak_resident;
+
+  //Rings around the camera's chunk, so the nearest missing chunks load first
+  GLfloat chunk_size = TERRAIN_CHUNK_CELLS * terrain->header.cell_size;
+  int center_x = floorf((camera_location[0] - terrain->origin_x) / chunk_size);
+  int center_z = floorf((camera_location[2] - terrain->origin_z) / chunk_size);
+  for(int ring = 0; ring <= TERRAIN_LOAD_RADIUS; ring++) {
+    for(int dz = -ring; dz <= ring; dz++) {
+      //Rows between the first and last only have their two end chunks in the ring
+      int step = (dz == -ring || dz == ring) ? 1 : 2 * ring;
+      for(int dx = -ring; dx <= ring; dx += step) {
+	if(terrain->loads_in_flight >= TERRAIN_MAX_LOADS_IN_FLIGHT) {
+	  profile_end(&zone);
+	  return;
+	}
+	int chunk_x = center_x + dx;
+	int chunk_z = center_z + dz;
+	if(chunk_x < 0 || chunk_z < 0 ||
+	   chunk_x >= (int)terrain->header.chunks_x || chunk_z >= (int)terrain->header.chunks_z) {
+	  continue;
+	}
+	if(request_chunk(terrain, chunk_x, chunk_z, center_x, center_z, ring) < 0) {
+	  //Everything resident is at least this close; the budget is spent
+	  profile_end(&zone);
+	  return;
+	}
+      }
+    }
+  }
+  profile_end(&zone);
+}
+
+static int box_outside_plane(const GLfloat* plane, const GLfloat* bounds_min, const GLfloat* bounds_max) {
+  //Test the corner farthest along the plane normal
+  GLfloat x = plane[0] > 0.0f ? bounds_max[0] : bounds_min[0];
+  GLfloat y = plane[1] > 0.0f ? bounds_max[1] : bounds_min[1];
+  GLfloat z = plane[2] > 0.0f ? bounds_max[2] : bounds_min[2];
+  return plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < 0.0f;
+}
+
+int terrain_select(terrain_t* terrain, arena_t* arena,
+		   const GLfloat* camera_location, const GLfloat* view, const GLfloat* projection,
+		   GLfloat pixel_scale, terrain_draw_t** draws) {
+  //Frustum planes are sums and differences of the rows of projection * view
+  GLfloat clip[16];
+  GLfloat view_copy[16];
+  memcpy(clip, projection, sizeof(clip));
+  memcpy(view_copy, view, sizeof(view_copy));
+  mat_mul4(clip, view_copy);
+  GLfloat planes[6][4];
+  for(int p = 0; p < 6; p++) {
+    const GLfloat* row = &clip[(p / 2) * 4];
+    GLfloat sign = (p & 1) ? -1.0f : 1.0f;
+    for(int k = 0; k < 4; k++) {
+      planes[p][k] = clip[12 + k] + sign * row[k];
+    }
+  }
+
+  *draws = arena_alloc(arena, sizeof(terrain_draw_t) * TERRAIN_MAX_CHUNKS, 0);
+  int num_draws = 0;
+  for(int i = 0; i < TERRAIN_MAX_CHUNKS; i++) {
+    const terrain_chunk_t* chunk = &terrain->chunks[i];
+    if(chunk_state(chunk) != TERRAIN_CHUNK_RESIDENT) {
+      continue;
+    }
+    int culled = 0;
+    for(int p = 0; p < 6 && !culled; p++) {
+      culled = box_outside_plane(planes[p], chunk->bounds_min, chunk->bounds_max);
+    }
+    if(culled) {
+      continue;
+    }
+
+    //Coarsest LOD whose error stays under the pixel threshold at this distance
+    GLfloat distance_sq = 0.0f;
+    for(int k = 0; k < 3; k++) {
+      GLfloat d = 0.0f;
+      if(camera_location[k] < chunk->bounds_min[k]) {
+	d = chunk->bounds_min[k] - camera_location[k];
+      } else if(camera_location[k] > chunk->bounds_max[k]) {
+	d = camera_location[k] - chunk->bounds_max[k];
+      }
+      distance_sq += d * d;
+    }
+    GLfloat distance = sqrtf(distance_sq);
+    int level = 0;
+    while(level + 1 < TERRAIN_LOD_LEVELS &&
+	  chunk->lod_error[level + 1] * pixel_scale <= TERRAIN_MAX_PIXEL_ERROR * distance) {
+      level++;
+    }
+
+    terrain_draw_t* draw = &(*draws)[num_draws++];
+    draw->vao = chunk->vao;
+    draw->vertices = chunk->vertices;
+    draw->indices = terrain->indices + terrain->lod_offset[level];
+    draw->index_count = terrain->lod_count[level];
+    draw->index_offset = (GLvoid*)(terrain->lod_offset[level] * sizeof(GLuint));
+  }
+  return num_draws;
+}
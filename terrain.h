@@ -0,0 +1,140 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include <epoxy/gl.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "gl_ops.h"
+#include "arena.h"
+
+#define TERRAIN_MAGIC "GLTR"
+#define TERRAIN_VERSION 1
+//Cells along each side of a chunk; chunks share their edge samples
+#define TERRAIN_CHUNK_CELLS 32
+//Stored samples per side, including a one-sample apron for normals
+#define TERRAIN_CHUNK_SAMPLES (TERRAIN_CHUNK_CELLS + 3)
+//Mesh steps of 1, 2, 4 ... TERRAIN_CHUNK_CELLS cells
+#define TERRAIN_LOD_LEVELS 6
+#define TERRAIN_GRID_VERTICES ((TERRAIN_CHUNK_CELLS + 1) * (TERRAIN_CHUNK_CELLS + 1))
+#define TERRAIN_CHUNK_VERTICES (TERRAIN_GRID_VERTICES + 4 * (TERRAIN_CHUNK_CELLS + 1))
+
+//Memory budget: chunks resident at once, on both the CPU and the GPU
+#define TERRAIN_MAX_CHUNKS 128
+//Chunks within this many chunks of the camera are streamed in
+#define TERRAIN_LOAD_RADIUS 4
+#define TERRAIN_MAX_LOADS_IN_FLIGHT 4
+#define TERRAIN_UPLOADS_PER_FRAME 2
+//Largest screen-space geometric error a LOD may have, in pixels
+#define TERRAIN_MAX_PIXEL_ERROR 2.0f
+
+/*
+ * On-disk layout, little-endian: a terrain_header_t followed by
+ * chunks_x * chunks_z fixed-size chunks in row-major order.  Each chunk
+ * is TERRAIN_CHUNK_SAMPLES^2 uint16_t heights, also row-major, mapped
+ * linearly onto [min_height, max_height].  Sample (0, 0) of a chunk
+ * sits one cell before the chunk's corner.
+ */
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t chunks_x;
+  uint32_t chunks_z;
+  uint32_t chunk_cells;
+  GLfloat cell_size;
+  GLfloat min_height;
+  GLfloat max_height;
+} terrain_header_t;
+
+typedef enum {
+  TERRAIN_CHUNK_FREE,
+  TERRAIN_CHUNK_LOADING,
+  //Mesh built on the loader thread, waiting for its upload
+  TERRAIN_CHUNK_LOADED,
+  TERRAIN_CHUNK_RESIDENT
+} terrain_chunk_state_t;
+
+typedef struct terrain terrain_t;
+
+typedef struct {
+  terrain_t* terrain;
+  //A terrain_chunk_state_t.  The loader thread only sets LOADED; the GL
+  //thread makes every other change.
+  int state;
+  int chunk_x;
+  int chunk_z;
+  int load_failed;
+  vertex_data_t* vertices;
+  GLfloat bounds_min[3];
+  GLfloat bounds_max[3];
+  //Largest height error of each LOD against the full-resolution mesh
+  GLfloat lod_error[TERRAIN_LOD_LEVELS];
+  GLuint vao;
+  GLuint vbo;
+} terrain_chunk_t;
+
+struct terrain {
+  int fd;
+  //Without GL, chunks are only drawn from their CPU meshes
+  int use_gl;
+  terrain_header_t header;
+  GLfloat origin_x;
+  GLfloat origin_z;
+  //Slot holding each map chunk, negative when it is not resident
+  int16_t* chunk_map;
+
+  terrain_chunk_t chunks[TERRAIN_MAX_CHUNKS];
+  pool_t mesh_pool;
+  int loads_in_flight;
+
+  //Disk reads run on their own thread rather than as jobs, so a frame
+  //waiting on its jobs never ends up doing terrain I/O
+  pthread_t loader;
+  pthread_mutex_t load_mutex;
+  pthread_cond_t load_cond;
+  int loader_running;
+  //Chunks waiting for the loader, oldest first
+  terrain_chunk_t* load_queue[TERRAIN_MAX_LOADS_IN_FLIGHT];
+  int load_head;
+  int load_count;
+
+  //Index lists of every LOD, shared by all chunks
+  GLuint* indices;
+  GLsizei lod_offset[TERRAIN_LOD_LEVELS];
+  GLsizei lod_count[TERRAIN_LOD_LEVELS];
+  GLuint ebo;
+
+  unsigned int chunks_loaded;
+  unsigned int chunks_evicted;
+  int peak_resident;
+};
+
+typedef struct {
+  GLuint vao;
+  const vertex_data_t* vertices;
+  const GLuint* indices;
+  GLsizei index_count;
+  //Byte offset of the indices in the shared element buffer
+  GLvoid* index_offset;
+} terrain_draw_t;
+
+//use_gl is 0 for the software renderer, which needs no buffers
+int terrain_open(terrain_t* terrain, const char* filename, int use_gl);
+//Stops the loader thread, then frees everything
+void terrain_close(terrain_t* terrain);
+/*
+ * Streams chunks around the camera: uploads a few finished loads,
+ * evicts the farthest chunks when the budget is full and starts new
+ * loads on the loader thread, nearest first.  Must be called on the GL thread.
+ */
+void terrain_update(terrain_t* terrain, const GLfloat* camera_location);
+/*
+ * Frustum culls resident chunks and picks a LOD for each.  pixel_scale
+ * converts an error at distance 1 into pixels.  The draw list is
+ * allocated in arena; returns the number of draws.
+ */
+int terrain_select(terrain_t* terrain, arena_t* arena,
+		   const GLfloat* camera_location, const GLfloat* view, const GLfloat* projection,
+		   GLfloat pixel_scale, terrain_draw_t** draws);
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Writes a procedural heightmap in the tiled format read by terrain.c.
+ *
+ * Usage: terrain_gen output.ter chunks_x chunks_z [seed]
+ *
+ * Heights are a pure function of world position, so chunks are
+ * generated and written one at a time and the whole map never has to
+ * fit in memory.  The area around the origin is flattened to the
+ * height of the old ground plane so the scene still sits on it.
+ */
+#include "terrain.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#define CELL_SIZE 1.0f
+#define GROUND_HEIGHT -1.0f
+#define HILL_HEIGHT 40.0f
+#define NOISE_OCTAVES 6
+//Wavelength of the lowest octave, in world units
+#define NOISE_SCALE 160.0f
+#define FLAT_RADIUS 12.0f
+#define BLEND_RADIUS 48.0f
+
+static uint32_t seed = 1;
+
+static GLfloat lattice_value(int x, int z) {
+  uint32_t h = (uint32_t)x * 374761393u + (uint32_t)z * 668265263u + seed * 2246822519u;
+  h = (h ^ (h >> 13)) * 1274126177u;
+  h ^= h >> 16;
+  return (h & 0xFFFFFF) / (GLfloat)0xFFFFFF;
+}
+
+static GLfloat smooth(GLfloat t) {
+  return t * t * (3.0f - 2.0f * t);
+}
+
+static GLfloat value_noise(GLfloat x, GLfloat z) {
+  int x0 = floorf(x);
+  int z0 = floorf(z);
+  GLfloat fx = smooth(x - x0);
+  GLfloat fz = smooth(z - z0);
+  GLfloat near_row = lattice_value(x0, z0) * (1.0f - fx) + lattice_value(x0 + 1, z0) * fx;
+  GLfloat far_row = lattice_value(x0, z0 + 1) * (1.0f - fx) + lattice_value(x0 + 1, z0 + 1) * fx;
+  return near_row * (1.0f - fz) + far_row * fz;
+}
+
+//Normalized height in [0, 1] at a world position
+static GLfloat height_at(GLfloat x, GLfloat z) {
+  GLfloat sum = 0.0f;
+  GLfloat amplitude = 0.5f;
+  GLfloat frequency = 1.0f / NOISE_SCALE;
+  GLfloat total = 0.0f;
+  for(int octave = 0; octave < NOISE_OCTAVES; octave++) {
+    sum += amplitude * value_noise(x * frequency, z * frequency);
+    total += amplitude;
+    amplitude *= 0.5f;
+    frequency *= 2.0f;
+  }
+  GLfloat height = sum / total;
+  height = height * height;
+
+  GLfloat radius = sqrtf(x * x + z * z);
+  GLfloat blend = (radius - FLAT_RADIUS) / (BLEND_RADIUS - FLAT_RADIUS);
+  blend = blend < 0.0f ? 0.0f : (blend > 1.0f ? 1.0f : blend);
+  return height * smooth(blend);
+}
+
+int main(int argc, char** argv) {
+  if(argc < 4) {
+    printf("Usage: %s output.ter chunks_x chunks_z [seed]\n", argv[0]);
+    return 1;
+  }
+  terrain_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TERRAIN_MAGIC, 4);
+  header.version = TERRAIN_VERSION;
+  header.chunks_x = atoi(argv[2]);
+  header.chunks_z = atoi(argv[3]);
+  header.chunk_cells = TERRAIN_CHUNK_CELLS;
+  header.cell_size = CELL_SIZE;
+  header.min_height = GROUND_HEIGHT;
+  header.max_height = GROUND_HEIGHT + HILL_HEIGHT;
+  if(argc > 4) {
+    seed = strtoul(argv[4], NULL, 10);
+  }
+  if(header.chunks_x == 0 || header.chunks_z == 0 ||
+     header.chunks_x > INT16_MAX || header.chunks_z > INT16_MAX) {
+    printf("[ERROR] Chunk counts must be between 1 and %d\n", INT16_MAX);
+    return 1;
+  }
+
+  FILE* output = fopen(argv[1], "wb");
+  if(output == NULL) {
+    printf("[ERROR] Unable to create %s: %s\n", argv[1], strerror(errno));
+    return 1;
+  }
+  fwrite(&header, sizeof(header), 1, output);
+
+  GLfloat chunk_size = TERRAIN_CHUNK_CELLS * CELL_SIZE;
+  GLfloat origin_x = -0.5f * header.chunks_x * chunk_size;
+  GLfloat origin_z = -0.5f * header.chunks_z * chunk_size;
+  uint16_t samples[TERRAIN_CHUNK_SAMPLES * TERRAIN_CHUNK_SAMPLES];
+  for(uint32_t chunk_z = 0; chunk_z < header.chunks_z; chunk_z++) {
+    for(uint32_t chunk_x = 0; chunk_x < header.chunks_x; chunk_x++) {
+      //Samples start one cell before the chunk corner for the apron
+      GLfloat corner_x = origin_x + chunk_x * chunk_size - CELL_SIZE;
+      GLfloat corner_z = origin_z + chunk_z * chunk_size - CELL_SIZE;
+      for(int j = 0; j < TERRAIN_CHUNK_SAMPLES; j++) {
+	for(int i = 0; i < TERRAIN_CHUNK_SAMPLES; i++) {
+	  GLfloat height = height_at(corner_x + i * CELL_SIZE, corner_z + j * CELL_SIZE);
+	  samples[j * TERRAIN_CHUNK_SAMPLES + i] = lrintf(height * 65535.0f);
+	}
+      }
+      fwrite(samples, sizeof(samples), 1, output);
+    }
+  }
+  if(fclose(output) != 0) {
+    printf("[ERROR] Failed writing %s: %s\n", argv[1], strerror(errno));
+    return 1;
+  }
+  printf("[INFO] Wrote %s: %ux%u chunks, %.0fx%.0f world units\n",
+	 argv[1], header.chunks_x, header.chunks_z,
+	 header.chunks_x * chunk_size, header.chunks_z * chunk_size);
+  return 0;
+}
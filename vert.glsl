@@ -7,14 +7,24 @@ uniform mat4 model;
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec2 texcoord_in;
 layout (location = 2) in vec3 normal_in;
+//Atlas region; constant per draw unless an instanced array is bound
+layout (location = 3) in vec4 tex_rect_in;
+layout (location = 4) in float tex_layer_in;
 
 out vec2 texcoord;
 out vec3 normal;
 out vec3 frag_pos;
+out float view_depth;
+flat out vec4 tex_rect;
+flat out float tex_layer;
 
 void main() {
-  gl_Position = projection * view * model * vec4(position, 1.0);
+  vec4 view_pos = view * model * vec4(position, 1.0);
+  gl_Position = projection * view_pos;
+  view_depth = -view_pos.z;
   texcoord = texcoord_in;
   normal = normalize(vec3(model * vec4(normal_in, 1.0f)));
   frag_pos = vec3(model * vec4(position, 1.0f));
+  tex_rect = tex_rect_in;
+  tex_layer = tex_layer_in;
 }